@@ -1,15 +1,19 @@
 // Copyright (c) 2024 Matt M Halenza
 // SPDX-License-Identifier: MIT
 #pragma once
+#include <algorithm>
 #include <chrono>
 #include <concepts>
+#include <exception>
 #include <format>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <thread>
 #include <span>
+#include <string>
 #include <string_view>
 #include <type_traits>
-#include <variant>
 #include <vector>
 #include <assert.h>
 #include <stdint.h>
@@ -30,6 +34,151 @@ template <typename T>
 concept ValidAddressOrDataType = std::is_same_v<T, T>;
 #endif
 
+inline constexpr size_t no_affinity_hint = ~size_t{0};
+
+// The highest address touched by a seqWrite()/seqRead() of `count` (> 0) registers, or nothing if the access wraps past the top of the address space.
+template <ValidAddressOrDataType AddressType>
+constexpr std::optional<AddressType> seqLast(AddressType start_addr, size_t count, size_t increment)
+{
+    assert(count != 0);
+    uint64_t const room = uint64_t{ std::numeric_limits<AddressType>::max() } - start_addr;
+    if (increment != 0 && uint64_t{ count - 1 } > room / increment)
+        return std::nullopt;
+    return static_cast<AddressType>(start_addr + (increment * (count - 1)));
+}
+// The highest address touched by a blockWrite()/blockRead() of `count` (> 0) registers in `rows` rows, or nothing if the access wraps past the top of the address space.
+template <ValidAddressOrDataType AddressType>
+constexpr std::optional<AddressType> blockLast(AddressType start_addr, size_t rows, size_t row_stride, size_t count, size_t increment)
+{
+    assert(rows != 0 && count != 0 && count % rows == 0);
+    if (rows == 0 || count < rows)
+        return std::nullopt;
+    uint64_t const room = uint64_t{ std::numeric_limits<AddressType>::max() } - start_addr;
+    if (row_stride != 0 && uint64_t{ rows - 1 } > room / row_stride)
+        return std::nullopt;
+    return seqLast(static_cast<AddressType>(start_addr + (row_stride * (rows - 1))), count / rows, increment);
+}
+
+template <typename PollerType>
+concept CPoller = requires(PollerType const &p)
+{
+    { p([]() -> bool { return true; }) } -> std::convertible_to<bool>;
+};
+
+class BasicPoller
+{
+public:
+    BasicPoller(std::chrono::microseconds initial_delay, std::chrono::microseconds wait_delay, std::chrono::microseconds timeout)
+        : initial_delay(initial_delay)
+        , wait_delay(wait_delay)
+        , timeout(timeout)
+    {}
+
+    template <typename CheckFunctorType>
+    bool operator()(CheckFunctorType fn) const
+    {
+        std::this_thread::sleep_for(this->initial_delay);
+        auto const start_timestamp = std::chrono::steady_clock::now();
+        do {
+            if (fn())
+                return true;
+            std::this_thread::sleep_for(this->wait_delay);
+        } while (std::chrono::steady_clock::now() < start_timestamp + this->timeout);
+        return false;
+    }
+
+    [[nodiscard]] std::chrono::microseconds getInitialDelay() const { return this->initial_delay; }
+    [[nodiscard]] std::chrono::microseconds getWaitDelay() const { return this->wait_delay; }
+    [[nodiscard]] std::chrono::microseconds getTimeout() const { return this->timeout; }
+
+private:
+    std::chrono::microseconds initial_delay;
+    std::chrono::microseconds wait_delay;
+    std::chrono::microseconds timeout;
+};
+static_assert(CPoller<BasicPoller>);
+
+class WriteVerifyFailureException : public std::runtime_error
+{
+public:
+    template <ValidAddressOrDataType DataType>
+    WriteVerifyFailureException(DataType expected, DataType mask, DataType full_actual)
+        : std::runtime_error(std::format("WriteVerify mismatch! Expected:0x{:0{}x} Got:0x{:0{}x} (0x{:0{}x})", expected, sizeof(DataType) * 2, full_actual & mask, sizeof(DataType) * 2, full_actual, sizeof(DataType) * 2))
+    {}
+};
+class ReadVerifyFailureException : public std::runtime_error
+{
+public:
+    template <ValidAddressOrDataType DataType>
+    ReadVerifyFailureException(DataType expected, DataType mask, DataType full_actual)
+        : std::runtime_error(std::format("ReadVerify mismatch! Expected:0x{:0{}x} Got:0x{:0{}x} (0x{:0{}x})", expected, sizeof(DataType) * 2, full_actual & mask, sizeof(DataType) * 2, full_actual, sizeof(DataType) * 2))
+    {}
+};
+class PollReadTimeoutException : public std::runtime_error
+{
+public:
+    template <ValidAddressOrDataType DataType>
+    PollReadTimeoutException(DataType expected, DataType mask, DataType full_actual)
+        : std::runtime_error(std::format("PollRead timeout! Expected:0x{:0{}x} Got:0x{:0{}x} (0x{:0{}x})", expected, sizeof(DataType) * 2, full_actual & mask, sizeof(DataType) * 2, full_actual, sizeof(DataType) * 2))
+    {}
+};
+
+// A recorded list of operations that a target can execute as a unit; see IRegisterTarget::executeSequence().
+template <ValidAddressOrDataType AddressType_, ValidAddressOrDataType DataType_>
+class RegisterSequence
+{
+public:
+    using AddressType = AddressType_;
+    using DataType = DataType_;
+
+    enum class OpCode : uint8_t { Seq, Step, Delay, Write, Read, ReadModifyWrite, WriteVerify, ReadVerify, PollRead };
+    struct Op
+    {
+        OpCode code;
+        AddressType addr = {};
+        DataType data = {};                     // write data, or the expected value for verifies and polls
+        DataType mask = {};
+        std::chrono::microseconds delay = {};   // the Delay duration, or the poller's initial delay
+        std::chrono::microseconds wait_delay = {};
+        std::chrono::microseconds timeout = {};
+        std::string msg = {};
+    };
+
+    RegisterSequence& seq(std::string_view msg) { return this->add({ .code = OpCode::Seq, .msg = std::string(msg) }); }
+    RegisterSequence& step(std::string_view msg) { return this->add({ .code = OpCode::Step, .msg = std::string(msg) }); }
+    RegisterSequence& delay(std::chrono::microseconds delay, std::string_view msg = "") { return this->add({ .code = OpCode::Delay, .delay = delay, .msg = std::string(msg) }); }
+    RegisterSequence& write(AddressType addr, DataType data, std::string_view msg = "") { return this->add({ .code = OpCode::Write, .addr = addr, .data = data, .msg = std::string(msg) }); }
+    // The value read is returned in the SequenceResult, at this operation's index.
+    RegisterSequence& read(AddressType addr, std::string_view msg = "") { return this->add({ .code = OpCode::Read, .addr = addr, .msg = std::string(msg) }); }
+    RegisterSequence& readModifyWrite(AddressType addr, DataType new_data, DataType mask, std::string_view msg = "") { return this->add({ .code = OpCode::ReadModifyWrite, .addr = addr, .data = new_data, .mask = mask, .msg = std::string(msg) }); }
+    RegisterSequence& writeVerify(AddressType addr, DataType data, DataType mask, std::string_view msg = "") { return this->add({ .code = OpCode::WriteVerify, .addr = addr, .data = data, .mask = mask, .msg = std::string(msg) }); }
+    RegisterSequence& readVerify(AddressType addr, DataType expected, DataType mask, std::string_view msg = "") { return this->add({ .code = OpCode::ReadVerify, .addr = addr, .data = expected, .mask = mask, .msg = std::string(msg) }); }
+    RegisterSequence& pollRead(BasicPoller const& poller, AddressType addr, DataType expected, DataType mask, std::string_view msg = "")
+    {
+        return this->add({ .code = OpCode::PollRead, .addr = addr, .data = expected, .mask = mask, .delay = poller.getInitialDelay(), .wait_delay = poller.getWaitDelay(), .timeout = poller.getTimeout(), .msg = std::string(msg) });
+    }
+
+    RegisterSequence& add(Op op)
+    {
+        this->ops.push_back(std::move(op));
+        return *this;
+    }
+    [[nodiscard]] std::span<Op const> getOps() const { return this->ops; }
+    [[nodiscard]] size_t size() const { return this->ops.size(); }
+    void clear() { this->ops.clear(); }
+
+private:
+    std::vector<Op> ops;
+};
+
+template <ValidAddressOrDataType DataType>
+struct SequenceResult
+{
+    std::vector<DataType> values;       // per operation: the value read (reads, verifies and polls), otherwise 0
+    size_t completed = 0;               // the number of operations that succeeded
+    std::exception_ptr error = nullptr; // why operation `completed` failed, if it did
+};
+
 template <ValidAddressOrDataType AddressType_, ValidAddressOrDataType DataType_>
 struct IRegisterTarget
 {
@@ -42,6 +191,7 @@ public:
 
     virtual std::string_view getName() const { return this->name; }
     virtual std::string_view getDomain() const { return "IRegisterTarget"; }
+    virtual size_t getAffinityHint() const { return no_affinity_hint; }
 
     virtual void write(AddressType addr, DataType data) = 0;
     [[nodiscard]] virtual DataType read(AddressType addr) = 0;
@@ -54,6 +204,76 @@ public:
         this->write(addr, v);
     }
 
+    // Compound operations: targets that can run these next to the device (such as a remote target's server) should override them,
+    // so each costs one transaction instead of one per step.
+    // Writes `data` and returns the value read back from `addr` afterwards.
+    [[nodiscard]] virtual DataType writeReadBack(AddressType addr, DataType data)
+    {
+        this->write(addr, data);
+        return this->read(addr);
+    }
+    // Reads `addr` on the poller's schedule until (value & mask) == (expected & mask).
+    // Returns whether it matched, with the last value read in `out_data`.
+    virtual bool pollRead(AddressType addr, DataType expected, DataType mask, BasicPoller const& poller, DataType& out_data)
+    {
+        DataType const expected_val = expected & mask;
+        return poller([&] {
+            out_data = this->read(addr);
+            return (out_data & mask) == expected_val;
+        });
+    }
+
+    // Executes `sequence` in order, stopping at the first failure, which is reported in the result rather than thrown.
+    // Targets that can run a whole sequence next to the device should override this.
+    virtual SequenceResult<DataType> executeSequence(RegisterSequence<AddressType, DataType> const& sequence)
+    {
+        using OpCode = typename RegisterSequence<AddressType, DataType>::OpCode;
+        SequenceResult<DataType> result;
+        result.values.resize(sequence.size());
+        try {
+            for (auto const& op : sequence.getOps()) {
+                DataType& value = result.values[result.completed];
+                DataType const expected_val = op.data & op.mask;
+                switch (op.code) {
+                case OpCode::Seq:
+                case OpCode::Step:
+                    break;
+                case OpCode::Delay:
+                    std::this_thread::sleep_for(op.delay);
+                    break;
+                case OpCode::Write:
+                    this->write(op.addr, op.data);
+                    break;
+                case OpCode::Read:
+                    value = this->read(op.addr);
+                    break;
+                case OpCode::ReadModifyWrite:
+                    this->readModifyWrite(op.addr, op.data, op.mask);
+                    break;
+                case OpCode::WriteVerify:
+                    value = this->writeReadBack(op.addr, op.data);
+                    if ((value & op.mask) != expected_val)
+                        throw WriteVerifyFailureException(expected_val, op.mask, value);
+                    break;
+                case OpCode::ReadVerify:
+                    value = this->read(op.addr);
+                    if ((value & op.mask) != expected_val)
+                        throw ReadVerifyFailureException(expected_val, op.mask, value);
+                    break;
+                case OpCode::PollRead:
+                    if (!this->pollRead(op.addr, op.data, op.mask, BasicPoller(op.delay, op.wait_delay, op.timeout), value))
+                        throw PollReadTimeoutException(expected_val, op.mask, value);
+                    break;
+                }
+                result.completed++;
+            }
+        }
+        catch (...) {
+            result.error = std::current_exception();
+        }
+        return result;
+    }
+
     virtual void seqWrite(AddressType start_addr, std::span<DataType const> data, size_t increment = sizeof(DataType))
     {
         for (size_t i = 0 ; i < data.size() ; i++) {
@@ -66,6 +286,43 @@ public:
             out_data[i] = this->read(start_addr + (increment * i));
         }
     }
+    virtual void seqFill(AddressType start_addr, DataType value, size_t count, size_t increment = sizeof(DataType))
+    {
+        for (size_t i = 0 ; i < count ; i++) {
+            this->write(start_addr + (increment * i), value);
+        }
+    }
+    // Applies readModifyWrite(addr, new_data, mask) to `count` sequential registers with one seqRead() and one seqWrite().
+    virtual void seqReadModifyWrite(AddressType start_addr, DataType new_data, DataType mask, size_t count, size_t increment = sizeof(DataType))
+    {
+        std::vector<DataType> values(count);
+        this->seqRead(start_addr, values, increment);
+        DataType const keep = static_cast<DataType>(~mask);
+        DataType const set = new_data & mask;
+        for (DataType& v : values) {
+            v = static_cast<DataType>((v & keep) | set);
+        }
+        this->seqWrite(start_addr, values, increment);
+    }
+
+    // A rectangle of `rows` rows, `row_stride` bytes apart, each a sequential access of data.size() / rows registers.
+    // `data`/`out_data` is row-major and its size must be a multiple of `rows`.
+    virtual void blockWrite(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType const> data, size_t increment = sizeof(DataType))
+    {
+        assert(rows != 0 && data.size() % rows == 0);
+        size_t const cols = data.size() / rows;
+        for (size_t r = 0 ; r < rows ; r++) {
+            this->seqWrite(start_addr + (row_stride * r), data.subspan(r * cols, cols), increment);
+        }
+    }
+    virtual void blockRead(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType> out_data, size_t increment = sizeof(DataType))
+    {
+        assert(rows != 0 && out_data.size() % rows == 0);
+        size_t const cols = out_data.size() / rows;
+        for (size_t r = 0 ; r < rows ; r++) {
+            this->seqRead(start_addr + (row_stride * r), out_data.subspan(r * cols, cols), increment);
+        }
+    }
 
     virtual void fifoWrite(AddressType fifo_addr, std::span<DataType const> data)
     {
@@ -86,6 +343,14 @@ public:
             this->write(ad.first, ad.second);
         }
     }
+    // Struct-of-arrays form; targets that batch compWrite() should override both forms.
+    virtual void compWrite(std::span<AddressType const> const addresses, std::span<DataType const> data)
+    {
+        assert(addresses.size() == data.size());
+        for (size_t i = 0 ; i < addresses.size() ; i++) {
+            this->write(addresses[i], data[i]);
+        }
+    }
     virtual void compRead(std::span<AddressType const> const addresses, std::span<DataType> out_data)
     {
         assert(addresses.size() == out_data.size());
@@ -97,41 +362,6 @@ private:
     std::string name;
 };
 
-template <typename PollerType>
-concept CPoller = requires(PollerType const &p)
-{
-    { p([]() -> bool { return true; }) } -> std::convertible_to<bool>;
-};
-
-class BasicPoller
-{
-public:
-    BasicPoller(std::chrono::microseconds initial_delay, std::chrono::microseconds wait_delay, std::chrono::microseconds timeout)
-        : initial_delay(initial_delay)
-        , wait_delay(wait_delay)
-        , timeout(timeout)
-    {}
-
-    template <typename CheckFunctorType>
-    bool operator()(CheckFunctorType fn) const
-    {
-        std::this_thread::sleep_for(this->initial_delay);
-        auto const start_timestamp = std::chrono::steady_clock::now();
-        do {
-            if (fn())
-                return true;
-            std::this_thread::sleep_for(this->wait_delay);
-        } while (std::chrono::steady_clock::now() < start_timestamp + this->timeout);
-        return false;
-    }
-
-private:
-    std::chrono::microseconds initial_delay;
-    std::chrono::microseconds wait_delay;
-    std::chrono::microseconds timeout;
-};
-static_assert(CPoller<BasicPoller>);
-
 extern BasicPoller const default_poller;
 #ifdef RTF_IMPLEMENTATION
 #ifndef RTF_DEFAULT_POLLER_INITIAL_DELAY
@@ -184,60 +414,66 @@ template <typename T>
 class OwnedOrViewedObject final
 {
 public:
-    OwnedOrViewedObject(T* viewed_obj) : object(viewed_obj) {}
-    OwnedOrViewedObject(std::unique_ptr<T> owned_obj) : object(std::move(owned_obj)) {}
-    OwnedOrViewedObject(std::shared_ptr<T> shared_obj) : object(std::move(shared_obj)) {}
-    T& operator*() const
-    {
-        return std::visit([](auto&& obj) {
-            using U = std::decay_t<decltype(obj)>;
-            if constexpr (std::is_same_v<U, T*>) {
-                return &obj;
-            }
-            else {
-                return *obj;
-            }
-        }, this->object);
-    }
-    T* operator->() const
-    {
-        return std::visit([](auto&& obj) {
-            using U = std::decay_t<decltype(obj)>;
-            if constexpr (std::is_same_v<U, T*>) {
-                return obj;
-            }
-            else {
-                return obj.get();
-            }
-        }, this->object);
-    }
+    OwnedOrViewedObject(T* viewed_obj) : ptr(viewed_obj) {}
+    OwnedOrViewedObject(std::unique_ptr<T> owned_obj) : owner(std::move(owned_obj)), ptr(owner.get()) {}
+    OwnedOrViewedObject(std::shared_ptr<T> shared_obj) : owner(std::move(shared_obj)), ptr(owner.get()) {}
+    T& operator*() const { return *this->ptr; }
+    T* operator->() const { return this->ptr; }
+    T* get() const { return this->ptr; }
 private:
-    std::variant<T*, std::unique_ptr<T>, std::shared_ptr<T>> object;
+    // Owned objects are held by a shared_ptr so that copies (e.g. FluentRegisterTarget handles) share ownership.
+    std::shared_ptr<T> owner;
+    T* ptr;
 };
 
-class WriteVerifyFailureException : public std::runtime_error
+template <ValidAddressOrDataType AddressType_, ValidAddressOrDataType DataType_>
+class PassthroughRegisterTarget : public IRegisterTarget<AddressType_, DataType_>
 {
 public:
-    template <ValidAddressOrDataType DataType>
-    WriteVerifyFailureException(DataType expected, DataType mask, DataType full_actual)
-        : std::runtime_error(std::format("WriteVerify mismatch! Expected:0x{:0{}x} Got:0x{:0{}x} (0x{:0{}x})", expected, sizeof(DataType) * 2, full_actual & mask, sizeof(DataType) * 2, full_actual, sizeof(DataType) * 2))
+    using AddressType = AddressType_;
+    using DataType = DataType_;
+    using ParentType = IRegisterTarget<AddressType, DataType>;
+
+    PassthroughRegisterTarget(ParentType& parent)
+        : ParentType(parent.getName())
+        , parent(&parent)
     {}
-};
-class ReadVerifyFailureException : public std::runtime_error
-{
-public:
-    template <ValidAddressOrDataType DataType>
-    ReadVerifyFailureException(DataType expected, DataType mask, DataType full_actual)
-        : std::runtime_error(std::format("ReadVerify mismatch! Expected:0x{:0{}x} Got:0x{:0{}x} (0x{:0{}x})", expected, sizeof(DataType) * 2, full_actual & mask, sizeof(DataType) * 2, full_actual, sizeof(DataType) * 2))
+    template <std::derived_from<ParentType> T>
+    PassthroughRegisterTarget(std::unique_ptr<T> parent)
+        : ParentType(parent->getName())
+        , parent(std::unique_ptr<ParentType>(std::move(parent)))
     {}
-};
-class PollReadTimeoutException : public std::runtime_error
-{
-public:
-    template <ValidAddressOrDataType DataType>
-    PollReadTimeoutException(DataType expected, DataType mask, DataType full_actual)
-        : std::runtime_error(std::format("PollRead timeout! Expected:0x{:0{}x} Got:0x{:0{}x} (0x{:0{}x})", expected, sizeof(DataType) * 2, full_actual & mask, sizeof(DataType) * 2, full_actual, sizeof(DataType) * 2))
+    template <std::derived_from<ParentType> T>
+    PassthroughRegisterTarget(std::shared_ptr<T> parent)
+        : ParentType(parent->getName())
+        , parent(std::shared_ptr<ParentType>(std::move(parent)))
     {}
+
+    virtual std::string_view getDomain() const override { return this->parent->getDomain(); }
+    virtual size_t getAffinityHint() const override { return this->parent->getAffinityHint(); }
+
+    virtual void write(AddressType addr, DataType data) override { this->parent->write(addr, data); }
+    [[nodiscard]] virtual DataType read(AddressType addr) override { return this->parent->read(addr); }
+    virtual void readModifyWrite(AddressType addr, DataType new_data, DataType mask) override { this->parent->readModifyWrite(addr, new_data, mask); }
+    [[nodiscard]] virtual DataType writeReadBack(AddressType addr, DataType data) override { return this->parent->writeReadBack(addr, data); }
+    virtual bool pollRead(AddressType addr, DataType expected, DataType mask, BasicPoller const& poller, DataType& out_data) override { return this->parent->pollRead(addr, expected, mask, poller, out_data); }
+    virtual SequenceResult<DataType> executeSequence(RegisterSequence<AddressType, DataType> const& sequence) override { return this->parent->executeSequence(sequence); }
+    virtual void seqWrite(AddressType start_addr, std::span<DataType const> data, size_t increment = sizeof(DataType)) override { this->parent->seqWrite(start_addr, data, increment); }
+    virtual void seqRead(AddressType start_addr, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override { this->parent->seqRead(start_addr, out_data, increment); }
+    virtual void seqFill(AddressType start_addr, DataType value, size_t count, size_t increment = sizeof(DataType)) override { this->parent->seqFill(start_addr, value, count, increment); }
+    virtual void seqReadModifyWrite(AddressType start_addr, DataType new_data, DataType mask, size_t count, size_t increment = sizeof(DataType)) override { this->parent->seqReadModifyWrite(start_addr, new_data, mask, count, increment); }
+    virtual void blockWrite(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType const> data, size_t increment = sizeof(DataType)) override { this->parent->blockWrite(start_addr, rows, row_stride, data, increment); }
+    virtual void blockRead(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override { this->parent->blockRead(start_addr, rows, row_stride, out_data, increment); }
+    virtual void fifoWrite(AddressType fifo_addr, std::span<DataType const> data) override { this->parent->fifoWrite(fifo_addr, data); }
+    virtual void fifoRead(AddressType fifo_addr, std::span<DataType> out_data) override { this->parent->fifoRead(fifo_addr, out_data); }
+    virtual void compWrite(std::span<std::pair<AddressType, DataType> const> addr_data) override { this->parent->compWrite(addr_data); }
+    virtual void compWrite(std::span<AddressType const> const addresses, std::span<DataType const> data) override { this->parent->compWrite(addresses, data); }
+    virtual void compRead(std::span<AddressType const> const addresses, std::span<DataType> out_data) override { this->parent->compRead(addresses, out_data); }
+
+protected:
+    ParentType& getParent() const { return *this->parent; }
+private:
+    OwnedOrViewedObject<ParentType> parent;
 };
 
 template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
@@ -247,27 +483,27 @@ private:
     void opStart(std::string_view msg)
     {
         if (this->interposer) {
-            this->interposer->opStart(this->target->getDomain(), this->target->getName(), msg);
+            this->interposer->opStart(this->target_domain, this->target_name, msg);
         }
     }
     template <typename... Args>
     void opStart(std::format_string<Args...> fmt, Args... args)
     {
         if (this->interposer) {
-            this->interposer->opStart(this->target->getDomain(), this->target->getName(), std::vformat(fmt.get(), std::make_format_args(args...)));
+            this->interposer->opStart(this->target_domain, this->target_name, std::vformat(fmt.get(), std::make_format_args(args...)));
         }
     }
     void opExtra(DataType data)
     {
         if (this->interposer) {
-            this->interposer->opExtra(this->target->getDomain(), this->target->getName(), std::format("0x{:0{}x}", data, sizeof(DataType) * 2));
+            this->interposer->opExtra(this->target_domain, this->target_name, std::format("0x{:0{}x}", data, sizeof(DataType) * 2));
         }
     }
     void opExtra(std::span<DataType const> data)
     {
         if (this->interposer) {
             for (auto const d : data) {
-                this->interposer->opExtra(this->target->getDomain(), this->target->getName(), std::format("0x{:0{}x}", d, sizeof(DataType) * 2));
+                this->interposer->opExtra(this->target_domain, this->target_name, std::format("0x{:0{}x}", d, sizeof(DataType) * 2));
             }
         }
     }
@@ -276,7 +512,7 @@ private:
     {
         if (this->interposer) {
             for (auto const a : addresses) {
-                this->interposer->opExtra(this->target->getDomain(), this->target->getName(), std::format("0x{:0{}x}", a, sizeof(AddressType) * 2));
+                this->interposer->opExtra(this->target_domain, this->target_name, std::format("0x{:0{}x}", a, sizeof(AddressType) * 2));
             }
         }
     }
@@ -284,26 +520,50 @@ private:
     {
         if (this->interposer) {
             for (auto const ad : addr_data) {
-                this->interposer->opExtra(this->target->getDomain(), this->target->getName(), std::format("0x{:0{}x} 0x{:0{}x}", ad.first, sizeof(AddressType) * 2, ad.second, sizeof(DataType) * 2));
+                this->interposer->opExtra(this->target_domain, this->target_name, std::format("0x{:0{}x} 0x{:0{}x}", ad.first, sizeof(AddressType) * 2, ad.second, sizeof(DataType) * 2));
+            }
+        }
+    }
+    void opExtra(std::span<AddressType const> addresses, std::span<DataType const> data)
+    {
+        if (this->interposer) {
+            for (size_t i = 0 ; i < addresses.size() ; i++) {
+                this->interposer->opExtra(this->target_domain, this->target_name, std::format("0x{:0{}x} 0x{:0{}x}", addresses[i], sizeof(AddressType) * 2, data[i], sizeof(DataType) * 2));
             }
         }
     }
     void opEnd()
     {
         if (this->interposer) {
-            this->interposer->opEnd(this->target->getDomain(), this->target->getName());
+            this->interposer->opEnd(this->target_domain, this->target_name);
+        }
+    }
+    // BasicPoller parameters can be handed to the target, so the whole poll may run next to the device.
+    template <CPoller PollerType>
+    bool doPoll(PollerType const& poller, AddressType addr, DataType expected_val, DataType mask, DataType& reg_val)
+    {
+        if constexpr (std::is_same_v<PollerType, BasicPoller>) {
+            return this->target->pollRead(addr, expected_val, mask, poller, reg_val);
+        }
+        else {
+            return poller([&] {
+                reg_val = this->target->read(addr);
+                return (reg_val & mask) == expected_val;
+            });
         }
     }
     void opError(std::string_view msg)
     {
         if (this->interposer) {
-            this->interposer->opError(this->target->getDomain(), this->target->getName(), msg);
+            this->interposer->opError(this->target_domain, this->target_name, msg);
         }
     }
 public:
     FluentRegisterTarget(IFluentRegisterTargetInterposer* interposer, IRegisterTarget<AddressType, DataType>& target)
         : interposer(interposer)
         , target(&target)
+        , target_domain(target.getDomain())
+        , target_name(target.getName())
     {}
     explicit FluentRegisterTarget(IRegisterTarget<AddressType, DataType>& target)
         : FluentRegisterTarget(IFluentRegisterTargetInterposer::getDefault(), target)
@@ -313,6 +573,8 @@ public:
     FluentRegisterTarget(IFluentRegisterTargetInterposer* interposer, std::unique_ptr<T> target)
         : interposer(interposer)
         , target(std::unique_ptr<IRegisterTarget<AddressType, DataType>>(std::move(target)))
+        , target_domain(this->target->getDomain())
+        , target_name(this->target->getName())
     {}
     template <std::derived_from<IRegisterTarget<AddressType, DataType>> T>
     explicit FluentRegisterTarget(std::unique_ptr<T> target)
@@ -323,6 +585,8 @@ public:
     FluentRegisterTarget(IFluentRegisterTargetInterposer* interposer, std::shared_ptr<T> target)
         : interposer(interposer)
         , target(std::shared_ptr<IRegisterTarget<AddressType, DataType>>(std::move(target)))
+        , target_domain(this->target->getDomain())
+        , target_name(this->target->getName())
     {}
     template <std::derived_from<IRegisterTarget<AddressType, DataType>> T>
     explicit FluentRegisterTarget(std::shared_ptr<T> target)
@@ -333,14 +597,14 @@ public:
     FluentRegisterTarget& seq(std::format_string<Args...> fmt, Args... args)
     {
         if (this->interposer) {
-            this->interposer->seq(this->target->getDomain(), this->target->getName(), std::vformat(fmt.get(), std::make_format_args(args...)));
+            this->interposer->seq(this->target_domain, this->target_name, std::vformat(fmt.get(), std::make_format_args(args...)));
         }
         return *this;
     }
     FluentRegisterTarget& seq(std::string_view msg)
     {
         if (this->interposer) {
-            this->interposer->seq(this->target->getDomain(), this->target->getName(), msg);
+            this->interposer->seq(this->target_domain, this->target_name, msg);
         }
         return *this;
     }
@@ -349,14 +613,14 @@ public:
     FluentRegisterTarget& step(std::format_string<Args...> fmt, Args... args)
     {
         if (this->interposer) {
-            this->interposer->step(this->target->getDomain(), this->target->getName(), std::vformat(fmt.get(), std::make_format_args(args...)));
+            this->interposer->step(this->target_domain, this->target_name, std::vformat(fmt.get(), std::make_format_args(args...)));
         }
         return *this;
     }
     FluentRegisterTarget& step(std::string_view msg)
     {
         if (this->interposer) {
-            this->interposer->step(this->target->getDomain(), this->target->getName(), msg);
+            this->interposer->step(this->target_domain, this->target_name, msg);
         }
         return *this;
     }
@@ -542,6 +806,60 @@ public:
         this->opEnd();
         return *this;
     }
+    FluentRegisterTarget& seqFill(AddressType start_addr, DataType value, size_t count, size_t increment = sizeof(DataType), std::string_view msg = "")
+    {
+        this->opStart("SeqFill(0x{:0{}x}, 0x{:0{}x}, {}, {}): {}", start_addr, sizeof(AddressType) * 2, value, sizeof(DataType) * 2, count, increment, msg);
+        try {
+            this->target->seqFill(start_addr, value, count, increment);
+        }
+        catch (std::exception const& ex) {
+            this->opError(ex.what());
+            throw;
+        }
+        this->opEnd();
+        return *this;
+    }
+    FluentRegisterTarget& seqReadModifyWrite(AddressType start_addr, DataType new_data, DataType mask, size_t count, size_t increment = sizeof(DataType), std::string_view msg = "")
+    {
+        this->opStart("SeqReadModifyWrite(0x{:0{}x}, 0x{:0{}x}, 0x{:0{}x}, {}, {}): {}", start_addr, sizeof(AddressType) * 2, new_data, sizeof(DataType) * 2, mask, sizeof(DataType) * 2, count, increment, msg);
+        try {
+            this->target->seqReadModifyWrite(start_addr, new_data, mask, count, increment);
+        }
+        catch (std::exception const& ex) {
+            this->opError(ex.what());
+            throw;
+        }
+        this->opEnd();
+        return *this;
+    }
+    FluentRegisterTarget& blockWrite(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType const> data, size_t increment = sizeof(DataType), std::string_view msg = "")
+    {
+        this->opStart("BlockWrite(0x{:0{}x}, {}, {}, {}.., {}): {}", start_addr, sizeof(AddressType) * 2, rows, row_stride, data.size(), increment, msg);
+        this->opExtra(data);
+        try {
+            this->target->blockWrite(start_addr, rows, row_stride, data, increment);
+        }
+        catch (std::exception const& ex) {
+            this->opError(ex.what());
+            throw;
+        }
+        this->opEnd();
+        return *this;
+    }
+    FluentRegisterTarget& blockRead(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType> out_data, size_t increment = sizeof(DataType), std::string_view msg = "")
+    {
+        this->opStart("BlockRead(0x{:0{}x}, {}, {}, {}.., {}): {}", start_addr, sizeof(AddressType) * 2, rows, row_stride, out_data.size(), increment, msg);
+        try {
+            this->target->blockRead(start_addr, rows, row_stride, out_data, increment);
+        }
+        catch (std::exception const& ex) {
+            this->opError(ex.what());
+            throw;
+        }
+        this->opExtra(out_data);
+        this->opEnd();
+        return *this;
+    }
 
     #ifdef RTF_INTEROP_RMF
     FluentRegisterTarget& seqWrite(::RMF::Register<AddressType, DataType> const& start_reg, std::span<DataType const> data, size_t increment = sizeof(DataType), std::string_view msg = "")
@@ -572,6 +890,32 @@ public:
         this->opEnd();
         return *this;
     }
+    FluentRegisterTarget& seqFill(::RMF::Register<AddressType, DataType> const& start_reg, DataType value, size_t count, size_t increment = sizeof(DataType), std::string_view msg = "")
+    {
+        this->opStart("SeqFill(0x{:0{}x} '{}', 0x{:0{}x}, {}, {}): {}", start_reg.address(), sizeof(AddressType) * 2, start_reg.fullName(), value, sizeof(DataType) * 2, count, increment, msg);
+        try {
+            this->target->seqFill(start_reg.address(), value, count, increment);
+        }
+        catch (std::exception const& ex) {
+            this->opError(ex.what());
+            throw;
+        }
+        this->opEnd();
+        return *this;
+    }
+    FluentRegisterTarget& seqReadModifyWrite(::RMF::Register<AddressType, DataType> const& start_reg, DataType new_data, DataType mask, size_t count, size_t increment = sizeof(DataType), std::string_view msg = "")
+    {
+        this->opStart("SeqReadModifyWrite(0x{:0{}x} '{}', 0x{:0{}x}, 0x{:0{}x}, {}, {}): {}", start_reg.address(), sizeof(AddressType) * 2, start_reg.fullName(), new_data, sizeof(DataType) * 2, mask, sizeof(DataType) * 2, count, increment, msg);
+        try {
+            this->target->seqReadModifyWrite(start_reg.address(), new_data, mask, count, increment);
+        }
+        catch (std::exception const& ex) {
+            this->opError(ex.what());
+            throw;
+        }
+        this->opEnd();
+        return *this;
+    }
     #endif
 
     FluentRegisterTarget& fifoWrite(AddressType fifo_addr, std::span<DataType const> data, std::string_view msg = "")
@@ -648,6 +992,21 @@ public:
         this->opEnd();
         return *this;
     }
+    FluentRegisterTarget& compWrite(std::span<AddressType const> const addresses, std::span<DataType const> data, std::string_view msg = "")
+    {
+        assert(addresses.size() == data.size());
+        this->opStart("CompWrite({}.., {}..): {}", addresses.size(), data.size(), msg);
+        this->opExtra(addresses, data);
+        try {
+            this->target->compWrite(addresses, data);
+        }
+        catch (std::exception const& ex) {
+            this->opError(ex.what());
+            throw;
+        }
+        this->opEnd();
+        return *this;
+    }
     FluentRegisterTarget& compRead(std::span<AddressType const> const addresses, std::span<DataType> out_data, std::string_view msg = "")
     {
         this->opStart("CompRead({}.., {}..): {}", addresses.size(), out_data.size(), msg);
@@ -668,8 +1027,7 @@ public:
     {
         this->opStart("WriteVerify(0x{:0{}x}, 0x{:0{}x}, 0x{:0{}x}): {}", addr, sizeof(AddressType) * 2, data, sizeof(DataType) * 2, mask, sizeof(DataType) * 2, msg);
         try {
-            this->target->write(addr, data);
-            DataType const reg_val = this->target->read(addr);
+            DataType const reg_val = this->target->writeReadBack(addr, data);
             DataType const expected_val = data & mask;
             if ((reg_val & mask) != expected_val)
                 throw WriteVerifyFailureException(expected_val, mask, reg_val);
@@ -687,8 +1045,7 @@ public:
     {
         this->opStart("WriteVerify(0x{:0{}x} '{}, 0x{:0{}x}, 0x{:0{}x}): {}", reg.address(), sizeof(AddressType) * 2, reg.fullName(), data, sizeof(DataType) * 2, mask, sizeof(DataType) * 2, msg);
         try {
-            this->target->write(reg.address(), data);
-            DataType const reg_val = this->target->read(reg.address());
+            DataType const reg_val = this->target->writeReadBack(reg.address(), data);
             DataType const expected_val = data & mask;
             if ((reg_val & mask) != expected_val)
                 throw WriteVerifyFailureException(expected_val, mask, reg_val);
@@ -706,8 +1063,7 @@ public:
         this->opStart("WriteVerify(0x{:0{}x} '{}, 0x{:0{}x}): {}", field.address(), sizeof(AddressType) * 2, field.fullName(), field_data, (field.size() + 3) / 4, msg);
         try {
             DataType const data = field.regVal(field_data);
-            this->target->write(field.address(), data);
-            DataType const reg_val = this->target->read(field.address());
+            DataType const reg_val = this->target->writeReadBack(field.address(), data);
             DataType const mask = field.regMask();
             DataType const expected_val = data & mask;
             if ((reg_val & mask) != expected_val)
@@ -786,10 +1142,7 @@ public:
         try {
             DataType const expected_val = expected & mask;
             DataType reg_val = {};
-            bool const success = poller([&] {
-                reg_val = this->target->read(addr) ;
-                return (reg_val & mask) == expected_val;
-            });
+            bool const success = this->doPoll(poller, addr, expected_val, mask, reg_val);
             if (!success)
                 throw PollReadTimeoutException(expected_val, mask, reg_val);
         }
@@ -813,10 +1166,7 @@ public:
         try {
             DataType const expected_val = expected & mask;
             DataType reg_val = {};
-            bool const success = poller([&] {
-                reg_val = this->target->read(reg.address()) ;
-                return (reg_val & mask) == expected_val;
-            });
+            bool const success = this->doPoll(poller, reg.address(), expected_val, mask, reg_val);
             if (!success)
                 throw PollReadTimeoutException(expected_val, mask, reg_val);
         }
@@ -841,10 +1191,7 @@ public:
         try {
             DataType const expected_val = expected & mask;
             DataType reg_val = {};
-            bool const success = poller([&] {
-                reg_val = this->target->read(field.address()) ;
-                return (reg_val & mask) == expected_val;
-            });
+            bool const success = this->doPoll(poller, field.address(), expected_val, mask, reg_val);
             if (!success)
                 throw PollReadTimeoutException(expected_val, mask, reg_val);
         }
@@ -918,6 +1265,65 @@ public:
     }
     #endif
 
+    // Executes `sequence` with IRegisterTarget::executeSequence(), so a target may run all of it next to the device,
+    // then reports each operation to the interposer as though it had been called individually.
+    // Returns the value read by each operation (0 for operations that don't read), or rethrows the error of the operation that failed.
+    std::vector<DataType> execute(RegisterSequence<AddressType, DataType> const& sequence)
+    {
+        using OpCode = typename RegisterSequence<AddressType, DataType>::OpCode;
+        SequenceResult<DataType> result = this->target->executeSequence(sequence);
+        auto const ops = sequence.getOps();
+        size_t const reported = std::min(ops.size(), result.completed + (result.error ? 1 : 0));
+        for (size_t i = 0 ; i < reported ; i++) {
+            auto const& op = ops[i];
+            DataType const value = result.values[i];
+            switch (op.code) {
+            case OpCode::Seq:
+                this->seq(op.msg);
+                continue;
+            case OpCode::Step:
+                this->step(op.msg);
+                continue;
+            case OpCode::Delay:
+                this->opStart("Delay({}): {}", op.delay, op.msg);
+                break;
+            case OpCode::Write:
+                this->opStart("Write(0x{:0{}x}, 0x{:0{}x}): {}", op.addr, sizeof(AddressType) * 2, op.data, sizeof(DataType) * 2, op.msg);
+                break;
+            case OpCode::Read:
+                this->opStart("Read(0x{:0{}x}): {}", op.addr, sizeof(AddressType) * 2, op.msg);
+                if (i < result.completed)
+                    this->opExtra(value);
+                break;
+            case OpCode::ReadModifyWrite:
+                this->opStart("ReadModifyWrite(0x{:0{}x}, 0x{:0{}x}, 0x{:0{}x}): {}", op.addr, sizeof(AddressType) * 2, op.data & op.mask, sizeof(DataType) * 2, op.mask, sizeof(DataType) * 2, op.msg);
+                break;
+            case OpCode::WriteVerify:
+                this->opStart("WriteVerify(0x{:0{}x}, 0x{:0{}x}, 0x{:0{}x}): {}", op.addr, sizeof(AddressType) * 2, op.data, sizeof(DataType) * 2, op.mask, sizeof(DataType) * 2, op.msg);
+                break;
+            case OpCode::ReadVerify:
+                this->opStart("ReadVerify(0x{:0{}x}, 0x{:0{}x}, 0x{:0{}x}): {}", op.addr, sizeof(AddressType) * 2, op.data, sizeof(DataType) * 2, op.mask, sizeof(DataType) * 2, op.msg);
+                break;
+            case OpCode::PollRead:
+                this->opStart("PollRead(0x{:0{}x}, 0x{:0{}x}, 0x{:0{}x}): {}", op.addr, sizeof(AddressType) * 2, op.data, sizeof(DataType) * 2, op.mask, sizeof(DataType) * 2, op.msg);
+                break;
+            }
+            if (i == result.completed) {
+                try {
+                    std::rethrow_exception(result.error);
+                }
+                catch (std::exception const& ex) {
+                    this->opError(ex.what());
+                    throw;
+                }
+            }
+            this->opEnd();
+        }
+        if (result.error)
+            std::rethrow_exception(result.error);
+        return std::move(result.values);
+    }
+
     // Overloads that take a std::initializer_list instead of std::span (see P2447, adopted into C++26, so in a decade these can be removed!)
     FluentRegisterTarget& seqWrite(AddressType start_addr, std::initializer_list<DataType const> data, size_t increment = sizeof(DataType), std::string_view msg = "")
     {
@@ -953,6 +1359,9 @@ public:
 private:
     IFluentRegisterTargetInterposer* interposer;
     OwnedOrViewedObject<IRegisterTarget<AddressType, DataType>> target;
+    // Cached so that interposer calls don't make two virtual calls each; copies share them along with the target.
+    std::string_view target_domain;
+    std::string_view target_name;
 };
 
 template <typename T>
@@ -0,0 +1,404 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include "RTF_Executor.h"
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <optional>
+
+namespace RTF {
+
+template <ValidAddressOrDataType AddressType_, ValidAddressOrDataType DataType_>
+class AsyncRegisterTarget : public IRegisterTarget<AddressType_, DataType_>
+{
+public:
+    using AddressType = AddressType_;
+    using DataType = DataType_;
+    using LaneType = IRegisterTarget<AddressType, DataType>;
+
+    AsyncRegisterTarget(std::string_view name, std::vector<OwnedOrViewedObject<LaneType>> lane_targets, Executor& executor = Executor::getDefault())
+        : IRegisterTarget<AddressType, DataType>(name)
+        , executor(executor)
+    {
+        assert(!lane_targets.empty());
+        for (auto& lane_target : lane_targets) {
+            this->lanes.push_back(std::make_unique<Lane>(std::move(lane_target), executor));
+        }
+    }
+
+    virtual std::string_view getDomain() const override { return this->lanes.front()->target->getDomain(); }
+
+    // Operations on addresses in [first_addr, last_addr] are kept in program order with respect to each other, not just per-address.
+    void setOrderingDomain(AddressType first_addr, AddressType last_addr, uint32_t domain)
+    {
+        assert(first_addr <= last_addr);
+        auto const it = std::upper_bound(this->domains.begin(), this->domains.end(), first_addr, [](AddressType a, OrderingDomain const& d) { return a < d.first_addr; });
+        // routeOf() only looks at the nearest domain starting at or below an address, so domains must not overlap.
+        assert(it == this->domains.begin() || std::prev(it)->last_addr < first_addr);
+        assert(it == this->domains.end() || last_addr < it->first_addr);
+        // Changing the routing moves addresses between lanes, so let everything already routed finish first.
+        this->fence();
+        this->domains.insert(it, { first_addr, last_addr, domain });
+    }
+    // Addresses outside any ordering domain are assigned to lanes in aligned blocks of `bytes` (a power of two; 4096 by default).
+    void setRoutingGranule(size_t bytes)
+    {
+        assert(std::has_single_bit(bytes));
+        this->fence();
+        this->granule_shift = static_cast<unsigned>(std::countr_zero(bytes));
+    }
+
+    // Blocks until every previously submitted operation has completed; operations submitted afterwards can't overtake it.
+    void fence()
+    {
+        for (auto& lane : this->lanes) {
+            lane->strand.wait();
+        }
+    }
+
+    std::future<void> writeAsync(AddressType addr, DataType data)
+    {
+        return this->submit(this->laneFor(addr), [=](LaneType& t) { t.write(addr, data); });
+    }
+    std::future<DataType> readAsync(AddressType addr)
+    {
+        return this->submit(this->laneFor(addr), [=](LaneType& t) { return t.read(addr); });
+    }
+    std::future<void> readModifyWriteAsync(AddressType addr, DataType new_data, DataType mask)
+    {
+        return this->submit(this->laneFor(addr), [=](LaneType& t) { t.readModifyWrite(addr, new_data, mask); });
+    }
+    std::future<DataType> writeReadBackAsync(AddressType addr, DataType data)
+    {
+        return this->submit(this->laneFor(addr), [=](LaneType& t) { return t.writeReadBack(addr, data); });
+    }
+    // Resolves to the last value read; check it against `mask` to see whether the poll matched or timed out.
+    std::future<DataType> pollReadAsync(AddressType addr, DataType expected, DataType mask, BasicPoller poller)
+    {
+        return this->submit(this->laneFor(addr), [=](LaneType& t) {
+            DataType out_data = {};
+            (void)t.pollRead(addr, expected, mask, poller, out_data);
+            return out_data;
+        });
+    }
+    // For the multi-register operations, the spans must stay valid until the returned future is ready.
+    // An operation whose registers map to several lanes is split into one part per lane, which run concurrently.
+    std::future<void> seqWriteAsync(AddressType start_addr, std::span<DataType const> data, size_t increment = sizeof(DataType))
+    {
+        return this->submitRuns(this->seqRuns(start_addr, data.size(), increment),
+            [=](LaneType& t) { t.seqWrite(start_addr, data, increment); },
+            [=](LaneType& t, size_t first, size_t n) { t.seqWrite(static_cast<AddressType>(start_addr + (increment * first)), data.subspan(first, n), increment); });
+    }
+    std::future<void> seqReadAsync(AddressType start_addr, std::span<DataType> out_data, size_t increment = sizeof(DataType))
+    {
+        return this->submitRuns(this->seqRuns(start_addr, out_data.size(), increment),
+            [=](LaneType& t) { t.seqRead(start_addr, out_data, increment); },
+            [=](LaneType& t, size_t first, size_t n) { t.seqRead(static_cast<AddressType>(start_addr + (increment * first)), out_data.subspan(first, n), increment); });
+    }
+    std::future<void> seqFillAsync(AddressType start_addr, DataType value, size_t count, size_t increment = sizeof(DataType))
+    {
+        return this->submitRuns(this->seqRuns(start_addr, count, increment),
+            [=](LaneType& t) { t.seqFill(start_addr, value, count, increment); },
+            [=](LaneType& t, size_t first, size_t n) { t.seqFill(static_cast<AddressType>(start_addr + (increment * first)), value, n, increment); });
+    }
+    std::future<void> seqReadModifyWriteAsync(AddressType start_addr, DataType new_data, DataType mask, size_t count, size_t increment = sizeof(DataType))
+    {
+        return this->submitRuns(this->seqRuns(start_addr, count, increment),
+            [=](LaneType& t) { t.seqReadModifyWrite(start_addr, new_data, mask, count, increment); },
+            [=](LaneType& t, size_t first, size_t n) { t.seqReadModifyWrite(static_cast<AddressType>(start_addr + (increment * first)), new_data, mask, n, increment); });
+    }
+    // A block split across lanes is issued as sequential accesses of (parts of) its rows.
+    std::future<void> blockWriteAsync(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType const> data, size_t increment = sizeof(DataType))
+    {
+        assert(rows != 0 && data.size() % rows == 0);
+        size_t const cols = data.size() / rows;
+        return this->submitRuns(this->blockRuns(start_addr, rows, row_stride, cols, increment),
+            [=](LaneType& t) { t.blockWrite(start_addr, rows, row_stride, data, increment); },
+            [=](LaneType& t, size_t first, size_t n) { t.seqWrite(blockAddr(start_addr, row_stride, cols, increment, first), data.subspan(first, n), increment); });
+    }
+    std::future<void> blockReadAsync(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType> out_data, size_t increment = sizeof(DataType))
+    {
+        assert(rows != 0 && out_data.size() % rows == 0);
+        size_t const cols = out_data.size() / rows;
+        return this->submitRuns(this->blockRuns(start_addr, rows, row_stride, cols, increment),
+            [=](LaneType& t) { t.blockRead(start_addr, rows, row_stride, out_data, increment); },
+            [=](LaneType& t, size_t first, size_t n) { t.seqRead(blockAddr(start_addr, row_stride, cols, increment, first), out_data.subspan(first, n), increment); });
+    }
+    std::future<void> fifoWriteAsync(AddressType fifo_addr, std::span<DataType const> data)
+    {
+        return this->submit(this->laneFor(fifo_addr), [=](LaneType& t) { t.fifoWrite(fifo_addr, data); });
+    }
+    std::future<void> fifoReadAsync(AddressType fifo_addr, std::span<DataType> out_data)
+    {
+        return this->submit(this->laneFor(fifo_addr), [=](LaneType& t) { t.fifoRead(fifo_addr, out_data); });
+    }
+    // A composite operation split across lanes gets one composite access per lane, of the registers on that lane.
+    std::future<void> compWriteAsync(std::span<std::pair<AddressType, DataType> const> addr_data)
+    {
+        return this->submitParts(this->compParts(addr_data.size(), [&](size_t i) { return addr_data[i].first; }),
+            [=](LaneType& t) { t.compWrite(addr_data); },
+            [=](LaneType& t, std::vector<size_t> const& indices) {
+                std::vector<std::pair<AddressType, DataType>> part;
+                part.reserve(indices.size());
+                for (size_t const i : indices) {
+                    part.push_back(addr_data[i]);
+                }
+                t.compWrite(part);
+            });
+    }
+    std::future<void> compWriteAsync(std::span<AddressType const> const addresses, std::span<DataType const> data)
+    {
+        assert(addresses.size() == data.size());
+        return this->submitParts(this->compParts(addresses.size(), [&](size_t i) { return addresses[i]; }),
+            [=](LaneType& t) { t.compWrite(addresses, data); },
+            [=](LaneType& t, std::vector<size_t> const& indices) {
+                std::vector<AddressType> part_addresses;
+                std::vector<DataType> part_data;
+                part_addresses.reserve(indices.size());
+                part_data.reserve(indices.size());
+                for (size_t const i : indices) {
+                    part_addresses.push_back(addresses[i]);
+                    part_data.push_back(data[i]);
+                }
+                t.compWrite(std::span<AddressType const>{ part_addresses }, std::span<DataType const>{ part_data });
+            });
+    }
+    std::future<void> compReadAsync(std::span<AddressType const> const addresses, std::span<DataType> out_data)
+    {
+        assert(addresses.size() == out_data.size());
+        return this->submitParts(this->compParts(addresses.size(), [&](size_t i) { return addresses[i]; }),
+            [=](LaneType& t) { t.compRead(addresses, out_data); },
+            [=](LaneType& t, std::vector<size_t> const& indices) {
+                std::vector<AddressType> part_addresses;
+                part_addresses.reserve(indices.size());
+                for (size_t const i : indices) {
+                    part_addresses.push_back(addresses[i]);
+                }
+                std::vector<DataType> part_data(indices.size());
+                t.compRead(part_addresses, part_data);
+                // Each part writes back only its own indices, so the parts don't race.
+                for (size_t j = 0 ; j < indices.size() ; j++) {
+                    out_data[indices[j]] = part_data[j];
+                }
+            });
+    }
+
+    // `sequence` must stay valid until the returned future is ready.
+    // A sequence can't be split without changing what a failed verify stops, so one that spans lanes acts as a fence and runs in the caller.
+    std::future<SequenceResult<DataType>> executeSequenceAsync(RegisterSequence<AddressType, DataType> const& sequence)
+    {
+        using OpCode = typename RegisterSequence<AddressType, DataType>::OpCode;
+        std::optional<size_t> lane;
+        bool spans = false;
+        for (auto const& op : sequence.getOps()) {
+            if (op.code == OpCode::Seq || op.code == OpCode::Step || op.code == OpCode::Delay)
+                continue;
+            size_t const op_lane = this->laneFor(op.addr);
+            spans = spans || (lane && *lane != op_lane);
+            lane = op_lane;
+        }
+        if (spans) {
+            this->fence();
+            std::packaged_task<SequenceResult<DataType>()> task([&] { return this->lanes.front()->target->executeSequence(sequence); });
+            auto future = task.get_future();
+            task();
+            return future;
+        }
+        return this->submit(lane.value_or(0), [&sequence](LaneType& t) { return t.executeSequence(sequence); });
+    }
+
+    virtual void write(AddressType addr, DataType data) override { this->await(this->writeAsync(addr, data)); }
+    [[nodiscard]] virtual DataType read(AddressType addr) override { return this->await(this->readAsync(addr)); }
+    virtual void readModifyWrite(AddressType addr, DataType new_data, DataType mask) override { this->await(this->readModifyWriteAsync(addr, new_data, mask)); }
+    [[nodiscard]] virtual DataType writeReadBack(AddressType addr, DataType data) override { return this->await(this->writeReadBackAsync(addr, data)); }
+    virtual SequenceResult<DataType> executeSequence(RegisterSequence<AddressType, DataType> const& sequence) override { return this->await(this->executeSequenceAsync(sequence)); }
+    virtual bool pollRead(AddressType addr, DataType expected, DataType mask, BasicPoller const& poller, DataType& out_data) override
+    {
+        out_data = this->await(this->pollReadAsync(addr, expected, mask, poller));
+        return (out_data & mask) == (expected & mask);
+    }
+    virtual void seqWrite(AddressType start_addr, std::span<DataType const> data, size_t increment = sizeof(DataType)) override { this->await(this->seqWriteAsync(start_addr, data, increment)); }
+    virtual void seqRead(AddressType start_addr, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override { this->await(this->seqReadAsync(start_addr, out_data, increment)); }
+    virtual void seqFill(AddressType start_addr, DataType value, size_t count, size_t increment = sizeof(DataType)) override { this->await(this->seqFillAsync(start_addr, value, count, increment)); }
+    virtual void seqReadModifyWrite(AddressType start_addr, DataType new_data, DataType mask, size_t count, size_t increment = sizeof(DataType)) override { this->await(this->seqReadModifyWriteAsync(start_addr, new_data, mask, count, increment)); }
+    virtual void blockWrite(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType const> data, size_t increment = sizeof(DataType)) override { this->await(this->blockWriteAsync(start_addr, rows, row_stride, data, increment)); }
+    virtual void blockRead(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override { this->await(this->blockReadAsync(start_addr, rows, row_stride, out_data, increment)); }
+    virtual void fifoWrite(AddressType fifo_addr, std::span<DataType const> data) override { this->await(this->fifoWriteAsync(fifo_addr, data)); }
+    virtual void fifoRead(AddressType fifo_addr, std::span<DataType> out_data) override { this->await(this->fifoReadAsync(fifo_addr, out_data)); }
+    virtual void compWrite(std::span<std::pair<AddressType, DataType> const> addr_data) override { this->await(this->compWriteAsync(addr_data)); }
+    virtual void compWrite(std::span<AddressType const> const addresses, std::span<DataType const> data) override { this->await(this->compWriteAsync(addresses, data)); }
+    virtual void compRead(std::span<AddressType const> const addresses, std::span<DataType> out_data) override { this->await(this->compReadAsync(addresses, out_data)); }
+
+private:
+    // The synchronous operations may be called from a worker of the same executor (e.g. from a Strand), so help run tasks while waiting.
+    template <typename T>
+    T await(std::future<T> future)
+    {
+        return this->executor.runUntilReady(std::move(future));
+    }
+
+    struct OrderingDomain
+    {
+        AddressType first_addr;
+        AddressType last_addr;
+        uint32_t domain;
+    };
+
+    struct Lane
+    {
+        Lane(OwnedOrViewedObject<LaneType> target, Executor& executor)
+            : target(std::move(target))
+            , strand(executor, this->target->getAffinityHint())
+        {}
+
+        OwnedOrViewedObject<LaneType> target;
+        Strand strand;
+    };
+
+    struct Route
+    {
+        size_t lane;
+        AddressType last_addr;  // the last address from the one routed onwards that is certain to share its lane
+    };
+    // Addresses in an ordering domain are keyed by the domain, all others by the granule they are in.
+    [[nodiscard]] Route routeOf(AddressType addr) const
+    {
+        auto const it = std::upper_bound(this->domains.begin(), this->domains.end(), addr, [](AddressType a, OrderingDomain const& d) { return a < d.first_addr; });
+        if (it != this->domains.begin() && addr <= std::prev(it)->last_addr)
+            return { this->laneOfKey(std::prev(it)->domain), std::prev(it)->last_addr };
+        uint64_t last = uint64_t{ addr } | ((uint64_t{1} << this->granule_shift) - 1);
+        if (it != this->domains.end())
+            last = std::min<uint64_t>(last, uint64_t{ it->first_addr } - 1);
+        last = std::min<uint64_t>(last, std::numeric_limits<AddressType>::max());
+        // A domain ID colliding with a granule number only costs some parallelism, never ordering.
+        return { this->laneOfKey(uint64_t{ addr } >> this->granule_shift), static_cast<AddressType>(last) };
+    }
+    [[nodiscard]] size_t laneOfKey(uint64_t key) const
+    {
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) % this->lanes.size();
+    }
+    [[nodiscard]] size_t laneFor(AddressType addr) const
+    {
+        return this->routeOf(addr).lane;
+    }
+
+    // Per lane, the (first index, count) runs of a multi-register operation that go to that lane.
+    using Runs = std::vector<std::vector<std::pair<size_t, size_t>>>;
+
+    // Splits the registers start_addr + (increment * i), i < count, into runs on one lane, one route lookup per run rather than per register.
+    void addSeqRuns(Runs& runs, AddressType start_addr, size_t count, size_t increment, size_t base_index) const
+    {
+        for (size_t i = 0 ; i < count ; ) {
+            AddressType const addr = static_cast<AddressType>(start_addr + (increment * i));
+            Route const route = this->routeOf(addr);
+            size_t n = count - i;
+            if (increment != 0)
+                n = static_cast<size_t>(std::min<uint64_t>(n, ((uint64_t{ route.last_addr } - addr) / increment) + 1));
+            auto& lane_runs = runs[route.lane];
+            // Only runs from this call are merged, so a block's runs never cross a row.
+            if (!lane_runs.empty() && lane_runs.back().first >= base_index && lane_runs.back().first + lane_runs.back().second == base_index + i)
+                lane_runs.back().second += n;
+            else
+                lane_runs.emplace_back(base_index + i, n);
+            i += n;
+        }
+    }
+    [[nodiscard]] Runs seqRuns(AddressType start_addr, size_t count, size_t increment) const
+    {
+        Runs runs(this->lanes.size());
+        this->addSeqRuns(runs, start_addr, count, increment, 0);
+        return runs;
+    }
+    // The indices of the runs are into the row-major data.
+    [[nodiscard]] Runs blockRuns(AddressType start_addr, size_t rows, size_t row_stride, size_t cols, size_t increment) const
+    {
+        Runs runs(this->lanes.size());
+        for (size_t r = 0 ; r < rows ; r++) {
+            this->addSeqRuns(runs, static_cast<AddressType>(start_addr + (row_stride * r)), cols, increment, r * cols);
+        }
+        return runs;
+    }
+    static AddressType blockAddr(AddressType start_addr, size_t row_stride, size_t cols, size_t increment, size_t index)
+    {
+        return static_cast<AddressType>(start_addr + (row_stride * (index / cols)) + (increment * (index % cols)));
+    }
+    // Per lane, the indices of the registers of a composite operation on that lane.
+    template <typename AddrFnType>
+    [[nodiscard]] std::vector<std::vector<size_t>> compParts(size_t count, AddrFnType addr_fn) const
+    {
+        std::vector<std::vector<size_t>> parts(this->lanes.size());
+        for (size_t i = 0 ; i < count ; i++) {
+            parts[this->laneFor(addr_fn(i))].push_back(i);
+        }
+        return parts;
+    }
+
+    template <typename WholeFnType, typename RunFnType>
+    std::future<void> submitRuns(Runs runs, WholeFnType whole_fn, RunFnType run_fn)
+    {
+        return this->submitParts(std::move(runs), std::move(whole_fn), [run_fn = std::move(run_fn)](LaneType& t, std::vector<std::pair<size_t, size_t>> const& lane_runs) {
+            for (auto const& [first, n] : lane_runs) {
+                run_fn(t, first, n);
+            }
+        });
+    }
+    // Runs `whole_fn` on the only lane with a non-empty part, or `part_fn` on every lane with one, concurrently.
+    template <typename PartType, typename WholeFnType, typename PartFnType>
+    std::future<void> submitParts(std::vector<PartType> parts, WholeFnType whole_fn, PartFnType part_fn)
+    {
+        std::vector<size_t> used;
+        for (size_t l = 0 ; l < parts.size() ; l++) {
+            if (!parts[l].empty())
+                used.push_back(l);
+        }
+        if (used.size() <= 1)
+            return this->submit(used.empty() ? 0 : used.front(), std::move(whole_fn));
+
+        struct Join
+        {
+            std::atomic<size_t> remaining;
+            std::promise<void> promise;
+            std::mutex mutex;
+            std::exception_ptr error;
+        };
+        auto join = std::make_shared<Join>();
+        join->remaining = used.size();
+        auto future = join->promise.get_future();
+        for (size_t const l : used) {
+            Lane& lane = *this->lanes[l];
+            lane.strand.post([&lane, join, part_fn, part = std::move(parts[l])] {
+                try {
+                    part_fn(*lane.target, part);
+                }
+                catch (...) {
+                    std::lock_guard lock(join->mutex);
+                    if (!join->error)
+                        join->error = std::current_exception();
+                }
+                if (join->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    if (join->error)
+                        join->promise.set_exception(join->error);
+                    else
+                        join->promise.set_value();
+                }
+            });
+        }
+        return future;
+    }
+
+    template <typename FnType>
+    auto submit(size_t lane_index, FnType fn) -> std::future<std::invoke_result_t<FnType, LaneType&>>
+    {
+        Lane& lane = *this->lanes[lane_index];
+        return lane.strand.submit([&lane, fn = std::move(fn)] { return fn(*lane.target); });
+    }
+
+    Executor& executor;
+    std::vector<std::unique_ptr<Lane>> lanes;
+    std::vector<OrderingDomain> domains;
+    unsigned granule_shift = 12;
+};
+
+}
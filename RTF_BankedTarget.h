@@ -0,0 +1,236 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include <algorithm>
+#include <optional>
+
+namespace RTF {
+
+// Exposes a paged register space: address bits [bank_shift, ...) select a bank through the parent's bank-select register,
+// and the remaining low bits are the address within the bank on the parent.
+template <ValidAddressOrDataType AddressType_, ValidAddressOrDataType DataType_>
+class BankedRegisterTarget : public IRegisterTarget<AddressType_, DataType_>
+{
+public:
+    using AddressType = AddressType_;
+    using DataType = DataType_;
+    using ParentType = IRegisterTarget<AddressType, DataType>;
+
+    BankedRegisterTarget(std::string_view name, OwnedOrViewedObject<ParentType> parent, AddressType bank_select_reg, unsigned bank_shift)
+        : IRegisterTarget<AddressType, DataType>(name)
+        , parent(std::move(parent))
+        , bank_select_reg(bank_select_reg)
+        , bank_shift(bank_shift)
+        , offset_mask(static_cast<AddressType>((AddressType{1} << bank_shift) - 1))
+    {
+        assert(bank_shift < sizeof(AddressType) * 8);
+    }
+    virtual std::string_view getDomain() const override { return "BankedRegisterTarget"; }
+    virtual size_t getAffinityHint() const override { return this->parent->getAffinityHint(); }
+
+    [[nodiscard]] AddressType bankOf(AddressType addr) const { return static_cast<AddressType>(addr >> this->bank_shift); }
+    [[nodiscard]] AddressType offsetOf(AddressType addr) const { return static_cast<AddressType>(addr & this->offset_mask); }
+
+    // Must be called if anything other than this target may have written the bank-select register.
+    void invalidateBankCache() { this->current_bank.reset(); }
+    [[nodiscard]] uint64_t getBankSwitches() const { return this->bank_switches; }
+
+    virtual void write(AddressType addr, DataType data) override
+    {
+        this->selectBank(this->bankOf(addr));
+        this->parent->write(this->offsetOf(addr), data);
+    }
+    [[nodiscard]] virtual DataType read(AddressType addr) override
+    {
+        this->selectBank(this->bankOf(addr));
+        return this->parent->read(this->offsetOf(addr));
+    }
+    virtual void readModifyWrite(AddressType addr, DataType new_data, DataType mask) override
+    {
+        this->selectBank(this->bankOf(addr));
+        this->parent->readModifyWrite(this->offsetOf(addr), new_data, mask);
+    }
+    [[nodiscard]] virtual DataType writeReadBack(AddressType addr, DataType data) override
+    {
+        this->selectBank(this->bankOf(addr));
+        return this->parent->writeReadBack(this->offsetOf(addr), data);
+    }
+    virtual bool pollRead(AddressType addr, DataType expected, DataType mask, BasicPoller const& poller, DataType& out_data) override
+    {
+        this->selectBank(this->bankOf(addr));
+        return this->parent->pollRead(this->offsetOf(addr), expected, mask, poller, out_data);
+    }
+
+    virtual void seqWrite(AddressType start_addr, std::span<DataType const> data, size_t increment = sizeof(DataType)) override
+    {
+        if (data.empty() || !this->sameBank(start_addr, seqLast(start_addr, data.size(), increment)))
+            return this->IRegisterTarget<AddressType, DataType>::seqWrite(start_addr, data, increment);
+        this->selectBank(this->bankOf(start_addr));
+        this->parent->seqWrite(this->offsetOf(start_addr), data, increment);
+    }
+    virtual void seqRead(AddressType start_addr, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override
+    {
+        if (out_data.empty() || !this->sameBank(start_addr, seqLast(start_addr, out_data.size(), increment)))
+            return this->IRegisterTarget<AddressType, DataType>::seqRead(start_addr, out_data, increment);
+        this->selectBank(this->bankOf(start_addr));
+        this->parent->seqRead(this->offsetOf(start_addr), out_data, increment);
+    }
+    virtual void seqFill(AddressType start_addr, DataType value, size_t count, size_t increment = sizeof(DataType)) override
+    {
+        if (count == 0 || !this->sameBank(start_addr, seqLast(start_addr, count, increment)))
+            return this->IRegisterTarget<AddressType, DataType>::seqFill(start_addr, value, count, increment);
+        this->selectBank(this->bankOf(start_addr));
+        this->parent->seqFill(this->offsetOf(start_addr), value, count, increment);
+    }
+    virtual void seqReadModifyWrite(AddressType start_addr, DataType new_data, DataType mask, size_t count, size_t increment = sizeof(DataType)) override
+    {
+        if (count == 0 || !this->sameBank(start_addr, seqLast(start_addr, count, increment)))
+            return this->IRegisterTarget<AddressType, DataType>::seqReadModifyWrite(start_addr, new_data, mask, count, increment);
+        this->selectBank(this->bankOf(start_addr));
+        this->parent->seqReadModifyWrite(this->offsetOf(start_addr), new_data, mask, count, increment);
+    }
+    virtual void blockWrite(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType const> data, size_t increment = sizeof(DataType)) override
+    {
+        assert(rows != 0 && data.size() % rows == 0);
+        if (data.empty() || !this->sameBank(start_addr, blockLast(start_addr, rows, row_stride, data.size(), increment)))
+            return this->IRegisterTarget<AddressType, DataType>::blockWrite(start_addr, rows, row_stride, data, increment);
+        this->selectBank(this->bankOf(start_addr));
+        this->parent->blockWrite(this->offsetOf(start_addr), rows, row_stride, data, increment);
+    }
+    virtual void blockRead(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override
+    {
+        assert(rows != 0 && out_data.size() % rows == 0);
+        if (out_data.empty() || !this->sameBank(start_addr, blockLast(start_addr, rows, row_stride, out_data.size(), increment)))
+            return this->IRegisterTarget<AddressType, DataType>::blockRead(start_addr, rows, row_stride, out_data, increment);
+        this->selectBank(this->bankOf(start_addr));
+        this->parent->blockRead(this->offsetOf(start_addr), rows, row_stride, out_data, increment);
+    }
+
+    virtual void fifoWrite(AddressType fifo_addr, std::span<DataType const> data) override
+    {
+        this->selectBank(this->bankOf(fifo_addr));
+        this->parent->fifoWrite(this->offsetOf(fifo_addr), data);
+    }
+    virtual void fifoRead(AddressType fifo_addr, std::span<DataType> out_data) override
+    {
+        this->selectBank(this->bankOf(fifo_addr));
+        this->parent->fifoRead(this->offsetOf(fifo_addr), out_data);
+    }
+
+    // Operations are regrouped by bank (starting with the currently selected one) so each bank is selected at most once.
+    // Order is preserved within a bank, but not between banks.
+    virtual void compWrite(std::span<std::pair<AddressType, DataType> const> addr_data) override
+    {
+        this->groupByBank(addr_data.size(), [&](size_t i) { return addr_data[i].first; });
+        std::vector<std::pair<AddressType, DataType>> chunk;
+        this->forEachBank([&](AddressType bank, std::span<size_t const> indices) {
+            chunk.clear();
+            for (size_t const i : indices) {
+                chunk.emplace_back(this->offsetOf(addr_data[i].first), addr_data[i].second);
+            }
+            this->selectBank(bank);
+            this->parent->compWrite(chunk);
+        });
+    }
+    virtual void compWrite(std::span<AddressType const> const addresses, std::span<DataType const> data) override
+    {
+        assert(addresses.size() == data.size());
+        this->groupByBank(addresses.size(), [&](size_t i) { return addresses[i]; });
+        std::vector<AddressType> chunk_addresses;
+        std::vector<DataType> chunk_data;
+        this->forEachBank([&](AddressType bank, std::span<size_t const> indices) {
+            chunk_addresses.clear();
+            chunk_data.clear();
+            for (size_t const i : indices) {
+                chunk_addresses.push_back(this->offsetOf(addresses[i]));
+                chunk_data.push_back(data[i]);
+            }
+            this->selectBank(bank);
+            this->parent->compWrite(std::span<AddressType const>{ chunk_addresses }, std::span<DataType const>{ chunk_data });
+        });
+    }
+    virtual void compRead(std::span<AddressType const> const addresses, std::span<DataType> out_data) override
+    {
+        assert(addresses.size() == out_data.size());
+        this->groupByBank(addresses.size(), [&](size_t i) { return addresses[i]; });
+        std::vector<AddressType> chunk_addresses;
+        std::vector<DataType> chunk_data;
+        this->forEachBank([&](AddressType bank, std::span<size_t const> indices) {
+            chunk_addresses.clear();
+            for (size_t const i : indices) {
+                chunk_addresses.push_back(this->offsetOf(addresses[i]));
+            }
+            chunk_data.resize(indices.size());
+            this->selectBank(bank);
+            this->parent->compRead(chunk_addresses, chunk_data);
+            for (size_t n = 0 ; n < indices.size() ; n++) {
+                out_data[indices[n]] = chunk_data[n];
+            }
+        });
+    }
+
+private:
+    // An access that wraps around the address space (no `b`) is never in one bank.
+    [[nodiscard]] bool sameBank(AddressType a, std::optional<AddressType> b) const
+    {
+        return b && this->bankOf(a) == this->bankOf(*b);
+    }
+    void selectBank(AddressType bank)
+    {
+        if (this->current_bank == bank)
+            return;
+        this->current_bank.reset();
+        this->parent->write(this->bank_select_reg, static_cast<DataType>(bank));
+        this->current_bank = bank;
+        this->bank_switches++;
+    }
+
+    // Fills `order` with operation indices stably sorted by bank, with the current bank first.
+    template <typename AddrFnType>
+    void groupByBank(size_t count, AddrFnType addr_fn)
+    {
+        this->order.resize(count);
+        this->order_banks.resize(count);
+        for (size_t i = 0 ; i < count ; i++) {
+            this->order[i] = i;
+            this->order_banks[i] = this->bankOf(addr_fn(i));
+        }
+        auto const current = this->current_bank;
+        std::stable_sort(this->order.begin(), this->order.end(), [&](size_t a, size_t b) {
+            AddressType const bank_a = this->order_banks[a];
+            AddressType const bank_b = this->order_banks[b];
+            if (bank_a == bank_b)
+                return false;
+            if (current == bank_a)
+                return true;
+            if (current == bank_b)
+                return false;
+            return bank_a < bank_b;
+        });
+    }
+    template <typename FnType>
+    void forEachBank(FnType fn)
+    {
+        std::span<size_t const> const all{ this->order };
+        for (size_t first = 0 ; first < all.size() ; ) {
+            AddressType const bank = this->order_banks[all[first]];
+            size_t last = first + 1;
+            while (last < all.size() && this->order_banks[all[last]] == bank)
+                last++;
+            fn(bank, all.subspan(first, last - first));
+            first = last;
+        }
+    }
+
+    OwnedOrViewedObject<ParentType> parent;
+    AddressType const bank_select_reg;
+    unsigned const bank_shift;
+    AddressType const offset_mask;
+    std::optional<AddressType> current_bank;
+    uint64_t bank_switches = 0;
+    std::vector<size_t> order;
+    std::vector<AddressType> order_banks;
+};
+
+}
@@ -0,0 +1,57 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include <algorithm>
+#include <cstring>
+
+namespace RTF {
+
+// Writes only the entries of `data` that differ from `shadow` (what the registers are known to hold), then updates `shadow` to match.
+// Each changed run is written with one seqWrite(); runs separated by `max_gap` or fewer unchanged entries are merged into one burst,
+// which is cheaper than starting a new burst on most targets.  Returns the number of registers written.
+template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+size_t deltaSeqWrite(IRegisterTarget<AddressType, DataType>& target, std::type_identity_t<AddressType> start_addr, std::type_identity_t<std::span<DataType const>> data, std::type_identity_t<std::span<DataType>> shadow, size_t max_gap = 0, size_t increment = sizeof(DataType))
+{
+    assert(data.size() == shadow.size());
+    size_t const n = data.size();
+    // Returns the index of the first difference at or after `from`, or `n` if there is none.
+    auto const nextDiff = [&](size_t from) -> size_t {
+        // Mostly-unchanged tables are skipped a chunk at a time with memcmp(), which uses the widest compares the platform has;
+        // only the chunk holding the difference is searched entry by entry.
+        if constexpr (std::has_unique_object_representations_v<DataType>) {
+            constexpr size_t chunk = 256 / sizeof(DataType);
+            while (from + chunk <= n && std::memcmp(data.data() + from, shadow.data() + from, chunk * sizeof(DataType)) == 0)
+                from += chunk;
+        }
+        return static_cast<size_t>(std::mismatch(data.begin() + from, data.end(), shadow.begin() + from).first - data.begin());
+    };
+    size_t written = 0;
+    for (size_t first = nextDiff(0) ; first < n ; ) {
+        size_t last = first + 1;
+        for (;;) {
+            while (last < n && data[last] != shadow[last])
+                last++;
+            size_t const next = nextDiff(last);
+            if (next == n || next - last > max_gap)
+                break;
+            last = next + 1;
+        }
+        target.seqWrite(static_cast<AddressType>(start_addr + (increment * first)), data.subspan(first, last - first), increment);
+        std::copy(data.begin() + first, data.begin() + last, shadow.begin() + first);
+        written += last - first;
+        first = (last < n) ? nextDiff(last) : n;
+    }
+    return written;
+}
+
+// As above, but the current contents are read back from the target with one seqRead() instead of coming from a shadow copy.
+template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+size_t deltaSeqWriteReadback(IRegisterTarget<AddressType, DataType>& target, std::type_identity_t<AddressType> start_addr, std::type_identity_t<std::span<DataType const>> data, size_t max_gap = 0, size_t increment = sizeof(DataType))
+{
+    std::vector<DataType> current(data.size());
+    target.seqRead(start_addr, current, increment);
+    return deltaSeqWrite(target, start_addr, data, std::span<DataType>{ current }, max_gap, increment);
+}
+
+}
@@ -0,0 +1,202 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include <algorithm>
+
+namespace RTF {
+
+// Describes a ring of `entries` fixed-size descriptors at `ring_addr`, with head/tail index registers.
+// The producer owns the tail and the consumer owns the head; one entry is always left empty so a full ring can be told from an empty one.
+template <ValidAddressOrDataType AddressType>
+struct DescriptorRingLayout
+{
+    AddressType ring_addr;
+    size_t entries;
+    size_t descriptor_words;    // DataType words per descriptor
+    AddressType head_addr;
+    AddressType tail_addr;
+};
+
+template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+class DescriptorRingBase
+{
+public:
+    using TargetType = IRegisterTarget<AddressType, DataType>;
+    using LayoutType = DescriptorRingLayout<AddressType>;
+
+    [[nodiscard]] LayoutType const& getLayout() const { return this->layout; }
+    [[nodiscard]] uint64_t getIndexReads() const { return this->index_reads; }
+    [[nodiscard]] uint64_t getIndexWrites() const { return this->index_writes; }
+
+protected:
+    DescriptorRingBase(TargetType& target, LayoutType const& layout)
+        : target(target)
+        , layout(layout)
+    {
+        assert(layout.entries >= 2 && layout.descriptor_words > 0);
+    }
+
+    [[nodiscard]] AddressType entryAddr(size_t index) const
+    {
+        return static_cast<AddressType>(this->layout.ring_addr + (index * this->layout.descriptor_words * sizeof(DataType)));
+    }
+    [[nodiscard]] size_t readIndex(AddressType addr)
+    {
+        this->index_reads++;
+        size_t const index = static_cast<size_t>(this->target.read(addr));
+        assert(index < this->layout.entries);
+        return index;
+    }
+    void writeIndex(AddressType addr, size_t index)
+    {
+        this->index_writes++;
+        this->target.write(addr, static_cast<DataType>(index));
+    }
+    // Calls fn(first_entry, entry_count) for the (at most two) contiguous pieces of `count` entries starting at `index`.
+    template <typename FnType>
+    void forEachSegment(size_t index, size_t count, FnType fn) const
+    {
+        if (count == 0)
+            return;
+        size_t const first = std::min(count, this->layout.entries - index);
+        fn(index, first);
+        if (first < count)
+            fn(0, count - first);
+    }
+
+    TargetType& target;
+    LayoutType const layout;
+    uint64_t index_reads = 0;
+    uint64_t index_writes = 0;
+};
+
+// Writes descriptors into a ring with at most two seqWrite()s per batch, and only writes the tail register on flush().
+// The head register is only read when the locally cached free space runs out.
+template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+class DescriptorRingProducer : public DescriptorRingBase<AddressType, DataType>
+{
+public:
+    using BaseType = DescriptorRingBase<AddressType, DataType>;
+    using typename BaseType::TargetType;
+    using typename BaseType::LayoutType;
+
+    // Assumes the ring is empty, with head and tail both at `start_index`.
+    DescriptorRingProducer(TargetType& target, LayoutType const& layout, size_t start_index = 0)
+        : BaseType(target, layout)
+        , tail(start_index)
+        , published_tail(start_index)
+        , cached_head(start_index)
+    {}
+
+    // Queues as many whole descriptors from `descriptors` as fit, and returns how many were queued.
+    // The device doesn't see them until flush().
+    size_t push(std::span<DataType const> descriptors)
+    {
+        size_t const words = this->layout.descriptor_words;
+        assert(descriptors.size() % words == 0);
+        size_t const wanted = descriptors.size() / words;
+        if (wanted > this->cachedFree())
+            this->cached_head = this->readIndex(this->layout.head_addr);
+        size_t const count = std::min(wanted, this->cachedFree());
+        size_t done = 0;
+        this->forEachSegment(this->tail, count, [&](size_t first, size_t n) {
+            this->target.seqWrite(this->entryAddr(first), descriptors.subspan(done * words, n * words));
+            done += n;
+        });
+        this->tail = (this->tail + count) % this->layout.entries;
+        return count;
+    }
+    // Rings the doorbell for everything pushed since the last flush(), if anything.
+    void flush()
+    {
+        if (this->tail == this->published_tail)
+            return;
+        this->writeIndex(this->layout.tail_addr, this->tail);
+        this->published_tail = this->tail;
+    }
+    size_t post(std::span<DataType const> descriptors)
+    {
+        size_t const rv = this->push(descriptors);
+        this->flush();
+        return rv;
+    }
+
+    // Free entries according to the last head read; the device may have freed more since.
+    [[nodiscard]] size_t cachedFree() const
+    {
+        size_t const n = this->layout.entries;
+        return (this->cached_head + n - this->tail - 1) % n;
+    }
+    [[nodiscard]] size_t getTail() const { return this->tail; }
+
+private:
+    size_t tail;
+    size_t published_tail;
+    size_t cached_head;
+};
+
+// Reads descriptors out of a ring with at most two seqRead()s per batch, and only writes the head register on flush().
+// The tail register is only read when the locally cached backlog runs out.
+template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+class DescriptorRingConsumer : public DescriptorRingBase<AddressType, DataType>
+{
+public:
+    using BaseType = DescriptorRingBase<AddressType, DataType>;
+    using typename BaseType::TargetType;
+    using typename BaseType::LayoutType;
+
+    DescriptorRingConsumer(TargetType& target, LayoutType const& layout, size_t start_index = 0)
+        : BaseType(target, layout)
+        , head(start_index)
+        , published_head(start_index)
+        , cached_tail(start_index)
+    {}
+
+    // Fills `out_descriptors` with as many whole descriptors as are available, and returns how many were read.
+    // The entries aren't returned to the producer until flush().
+    size_t pop(std::span<DataType> out_descriptors)
+    {
+        size_t const words = this->layout.descriptor_words;
+        assert(out_descriptors.size() % words == 0);
+        size_t const wanted = out_descriptors.size() / words;
+        if (wanted > this->cachedAvailable())
+            this->cached_tail = this->readIndex(this->layout.tail_addr);
+        size_t const count = std::min(wanted, this->cachedAvailable());
+        size_t done = 0;
+        this->forEachSegment(this->head, count, [&](size_t first, size_t n) {
+            this->target.seqRead(this->entryAddr(first), out_descriptors.subspan(done * words, n * words));
+            done += n;
+        });
+        this->head = (this->head + count) % this->layout.entries;
+        return count;
+    }
+    void flush()
+    {
+        if (this->head == this->published_head)
+            return;
+        this->writeIndex(this->layout.head_addr, this->head);
+        this->published_head = this->head;
+    }
+    size_t consume(std::span<DataType> out_descriptors)
+    {
+        size_t const rv = this->pop(out_descriptors);
+        this->flush();
+        return rv;
+    }
+
+    // Filled entries according to the last tail read; the device may have produced more since.
+    [[nodiscard]] size_t cachedAvailable() const
+    {
+        size_t const n = this->layout.entries;
+        return (this->cached_tail + n - this->head) % n;
+    }
+    [[nodiscard]] size_t getHead() const { return this->head; }
+
+private:
+    size_t head;
+    size_t published_head;
+    size_t cached_tail;
+};
+
+}
@@ -0,0 +1,427 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <utility>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifndef RTF_EXECUTOR_THREADS
+#define RTF_EXECUTOR_THREADS 0
+#endif
+#ifndef RTF_EXECUTOR_PIN_THREADS
+#define RTF_EXECUTOR_PIN_THREADS false
+#endif
+
+namespace RTF {
+
+struct ExecutorOptions
+{
+    size_t threads = 0;         // 0 means one per hardware thread
+    bool pin_threads = false;   // pin worker N to CPU N (Linux only; ignored elsewhere)
+};
+
+class Executor final
+{
+public:
+    using TaskType = std::function<void()>;
+
+    explicit Executor(ExecutorOptions options = {})
+    {
+        size_t const hw = std::max(1u, std::thread::hardware_concurrency());
+        size_t const count = options.threads ? options.threads : hw;
+        for (size_t i = 0 ; i < count ; i++) {
+            this->workers.push_back(std::make_unique<Worker>());
+        }
+        for (size_t i = 0 ; i < count ; i++) {
+            this->workers[i]->thread = std::thread([this, i] { this->run(i); });
+            if (options.pin_threads)
+                pinThread(this->workers[i]->thread, i % hw);
+        }
+    }
+    ~Executor()
+    {
+        {
+            std::lock_guard lock(this->sleep_mutex);
+            this->stopping = true;
+        }
+        this->sleep_cv.notify_all();
+        for (auto& worker : this->workers) {
+            worker->thread.join();
+        }
+    }
+    Executor(Executor const&) = delete;
+    Executor& operator=(Executor const&) = delete;
+
+    // The process-wide executor used by RTF's parallel algorithms, configured by RTF_EXECUTOR_THREADS and RTF_EXECUTOR_PIN_THREADS.
+    static Executor& getDefault()
+    {
+        static Executor executor({ RTF_EXECUTOR_THREADS, RTF_EXECUTOR_PIN_THREADS });
+        return executor;
+    }
+
+    [[nodiscard]] size_t threadCount() const { return this->workers.size(); }
+
+    void post(TaskType task)
+    {
+        size_t const self = this->currentWorker();
+        size_t const index = (self != no_affinity_hint) ? self : (this->next_worker.fetch_add(1, std::memory_order_relaxed) % this->workers.size());
+        this->push(index, std::move(task));
+    }
+    // Tasks with the same affinity hint prefer the same worker (and therefore CPU, if pinned), but may still be stolen by idle workers.
+    void post(size_t affinity_hint, TaskType task)
+    {
+        if (affinity_hint == no_affinity_hint)
+            return this->post(std::move(task));
+        this->push(affinity_hint % this->workers.size(), std::move(task));
+    }
+    // As post(), but the task is queued behind everything already waiting on its worker; for tasks that re-post themselves to yield the worker.
+    void defer(size_t affinity_hint, TaskType task)
+    {
+        size_t const self = this->currentWorker();
+        size_t index = 0;
+        if (affinity_hint != no_affinity_hint)
+            index = affinity_hint % this->workers.size();
+        else
+            index = (self != no_affinity_hint) ? self : (this->next_worker.fetch_add(1, std::memory_order_relaxed) % this->workers.size());
+        this->push(index, std::move(task), true);
+    }
+
+    template <typename FnType>
+    auto submit(FnType fn) -> std::future<std::invoke_result_t<FnType>>
+    {
+        return this->submit(no_affinity_hint, std::move(fn));
+    }
+    template <typename FnType>
+    auto submit(size_t affinity_hint, FnType fn) -> std::future<std::invoke_result_t<FnType>>
+    {
+        auto task = std::make_shared<std::packaged_task<std::invoke_result_t<FnType>()>>(std::move(fn));
+        auto future = task->get_future();
+        this->post(affinity_hint, [task] { (*task)(); });
+        return future;
+    }
+
+    // Runs one queued task in the calling thread, if there is one; lets blocked callers help instead of deadlocking the pool.
+    bool runOne()
+    {
+        size_t const self = this->currentWorker();
+        TaskType task = this->take(self != no_affinity_hint ? self : 0);
+        if (!task)
+            return false;
+        task();
+        return true;
+    }
+    // Waits for `future`, running queued tasks in the meantime, so that a worker waiting on work queued behind it can't deadlock the pool.
+    template <typename T>
+    T runUntilReady(std::future<T> future)
+    {
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            if (!this->runOne())
+                future.wait_for(std::chrono::milliseconds(1));
+        }
+        return future.get();
+    }
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<TaskType> queue;
+        std::thread thread;
+    };
+
+    static void pinThread([[maybe_unused]] std::thread& thread, [[maybe_unused]] size_t cpu)
+    {
+        #if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+        #endif
+    }
+
+    size_t currentWorker() const
+    {
+        return (current_executor == this) ? current_worker : no_affinity_hint;
+    }
+
+    void push(size_t index, TaskType task, bool deferred = false)
+    {
+        {
+            std::lock_guard lock(this->workers[index]->mutex);
+            // A worker takes its own tasks from the back, so the front is where a deferred task waits longest.
+            if (deferred)
+                this->workers[index]->queue.push_front(std::move(task));
+            else
+                this->workers[index]->queue.push_back(std::move(task));
+            // Count the task before releasing the queue, so take() can't pop it (and decrement) first.
+            this->queued.fetch_add(1, std::memory_order_seq_cst);
+        }
+        // A worker going to sleep counts itself in `sleepers` before checking `queued`, and we count the task before checking `sleepers`,
+        // so (both being seq_cst) at least one of us sees the other.  Taking the mutex then ensures the worker is either still
+        // before its check (and will see the task) or already waiting (and will get the notification).
+        if (this->sleepers.load(std::memory_order_seq_cst) > 0) {
+            { std::lock_guard sleep_lock(this->sleep_mutex); }
+            this->sleep_cv.notify_one();
+        }
+    }
+
+    // Takes from the back of our own queue (most recently posted, still hot in cache) and steals from the front of the others.
+    TaskType take(size_t self)
+    {
+        size_t const count = this->workers.size();
+        for (size_t n = 0 ; n < count ; n++) {
+            Worker& worker = *this->workers[(self + n) % count];
+            std::unique_lock lock(worker.mutex);
+            if (worker.queue.empty())
+                continue;
+            TaskType task;
+            if (n == 0) {
+                task = std::move(worker.queue.back());
+                worker.queue.pop_back();
+            }
+            else {
+                task = std::move(worker.queue.front());
+                worker.queue.pop_front();
+            }
+            lock.unlock();
+            this->queued.fetch_sub(1, std::memory_order_relaxed);
+            return task;
+        }
+        return {};
+    }
+
+    void run(size_t index)
+    {
+        current_executor = this;
+        current_worker = index;
+        for (;;) {
+            if (TaskType task = this->take(index)) {
+                task();
+                continue;
+            }
+            std::unique_lock lock(this->sleep_mutex);
+            this->sleepers.fetch_add(1, std::memory_order_seq_cst);
+            this->sleep_cv.wait(lock, [this] { return this->stopping || this->queued.load(std::memory_order_seq_cst) > 0; });
+            this->sleepers.fetch_sub(1, std::memory_order_relaxed);
+            if (this->stopping && this->queued.load(std::memory_order_relaxed) == 0)
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> next_worker = 0;
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+    std::atomic<size_t> queued = 0;     // tasks in all queues
+    std::atomic<size_t> sleepers = 0;   // workers waiting on sleep_cv, or about to
+    bool stopping = false;
+
+    static inline thread_local Executor const* current_executor = nullptr;
+    static inline thread_local size_t current_worker = 0;
+};
+
+// Tracks a set of tasks posted to an Executor so the caller can wait for all of them and observe the first error.
+class TaskGroup final
+{
+public:
+    explicit TaskGroup(Executor& executor = Executor::getDefault()) : executor(executor) {}
+    ~TaskGroup()
+    {
+        this->waitAll();
+    }
+    TaskGroup(TaskGroup const&) = delete;
+    TaskGroup& operator=(TaskGroup const&) = delete;
+
+    template <typename FnType>
+    void post(FnType fn)
+    {
+        this->post(no_affinity_hint, std::move(fn));
+    }
+    template <typename FnType>
+    void post(size_t affinity_hint, FnType fn)
+    {
+        this->state->remaining.fetch_add(1, std::memory_order_relaxed);
+        this->executor.post(affinity_hint, [state = this->state, fn = std::move(fn)]() mutable {
+            try {
+                fn();
+            }
+            catch (...) {
+                std::lock_guard lock(state->mutex);
+                if (!state->error)
+                    state->error = std::current_exception();
+            }
+            if (state->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard lock(state->mutex);
+                state->cv.notify_all();
+            }
+        });
+    }
+
+    // Waits for every posted task, running queued work in the meantime, then rethrows the first error.
+    void wait()
+    {
+        this->waitAll();
+        std::lock_guard lock(this->state->mutex);
+        if (auto error = std::exchange(this->state->error, nullptr))
+            std::rethrow_exception(error);
+    }
+
+private:
+    struct State
+    {
+        std::atomic<size_t> remaining = 0;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::exception_ptr error;
+    };
+
+    void waitAll()
+    {
+        while (this->state->remaining.load(std::memory_order_acquire) != 0) {
+            if (this->executor.runOne())
+                continue;
+            std::unique_lock lock(this->state->mutex);
+            this->state->cv.wait_for(lock, std::chrono::milliseconds(1), [this] { return this->state->remaining.load(std::memory_order_acquire) == 0; });
+        }
+    }
+
+    Executor& executor;
+    std::shared_ptr<State> state = std::make_shared<State>();
+};
+
+// A serial queue on an Executor: tasks posted to one Strand run one at a time, in order, on whichever worker is free.
+// Different strands run in parallel, so a strand per target replaces a per-target mutex or thread.
+class Strand final
+{
+public:
+    using TaskType = Executor::TaskType;
+
+    explicit Strand(Executor& executor = Executor::getDefault(), size_t affinity_hint = no_affinity_hint)
+        : state(std::make_shared<State>(executor, affinity_hint))
+    {}
+    ~Strand()
+    {
+        this->wait();
+    }
+    Strand(Strand const&) = delete;
+    Strand& operator=(Strand const&) = delete;
+
+    // `task` must not throw; use submit() to get errors back.
+    void post(TaskType task)
+    {
+        bool schedule = false;
+        {
+            std::lock_guard lock(this->state->mutex);
+            this->state->queue.push_back(std::move(task));
+            schedule = !std::exchange(this->state->scheduled, true);
+        }
+        if (schedule)
+            State::schedule(this->state);
+    }
+    template <typename FnType>
+    auto submit(FnType fn) -> std::future<std::invoke_result_t<FnType>>
+    {
+        auto task = std::make_shared<std::packaged_task<std::invoke_result_t<FnType>()>>(std::move(fn));
+        auto future = task->get_future();
+        this->post([task] { (*task)(); });
+        return future;
+    }
+
+    // Waits until every task posted so far has run, running executor work in the meantime.
+    void wait()
+    {
+        for (;;) {
+            {
+                std::lock_guard lock(this->state->mutex);
+                if (!this->state->scheduled)
+                    return;
+            }
+            if (this->state->executor.runOne())
+                continue;
+            std::unique_lock lock(this->state->mutex);
+            this->state->idle_cv.wait_for(lock, std::chrono::milliseconds(1), [this] { return !this->state->scheduled; });
+        }
+    }
+
+private:
+    struct State
+    {
+        State(Executor& executor, size_t affinity_hint) : executor(executor), affinity_hint(affinity_hint) {}
+
+        static void schedule(std::shared_ptr<State> const& state, bool yield = false)
+        {
+            if (yield)
+                state->executor.defer(state->affinity_hint, [state] { drain(state); });
+            else
+                state->executor.post(state->affinity_hint, [state] { drain(state); });
+        }
+        // Runs a bounded batch and then yields the worker, so one busy strand can't starve the others.
+        static void drain(std::shared_ptr<State> const& state)
+        {
+            constexpr size_t batch = 64;
+            for (size_t n = 0 ; n < batch ; n++) {
+                TaskType task;
+                {
+                    std::lock_guard lock(state->mutex);
+                    if (state->queue.empty()) {
+                        state->scheduled = false;
+                        state->idle_cv.notify_all();
+                        return;
+                    }
+                    task = std::move(state->queue.front());
+                    state->queue.pop_front();
+                }
+                task();
+            }
+            schedule(state, true);
+        }
+
+        Executor& executor;
+        size_t const affinity_hint;
+        std::mutex mutex;
+        std::condition_variable idle_cv;
+        std::deque<TaskType> queue;
+        bool scheduled = false;
+    };
+
+    std::shared_ptr<State> state;
+};
+
+// Runs every operation on one FluentRegisterTarget through a Strand, so many threads can share it without a mutex.
+template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+class FluentTargetStrand final
+{
+public:
+    using FluentType = FluentRegisterTarget<AddressType, DataType>;
+
+    explicit FluentTargetStrand(FluentType target, Executor& executor = Executor::getDefault(), size_t affinity_hint = no_affinity_hint)
+        : target(std::move(target))
+        , strand(executor, affinity_hint)
+    {}
+
+    // `fn` is called as fn(FluentRegisterTarget&) on the strand; its result or exception is delivered through the future.
+    template <typename FnType>
+    auto submit(FnType fn) -> std::future<std::invoke_result_t<FnType, FluentType&>>
+    {
+        return this->strand.submit([this, fn = std::move(fn)]() mutable { return fn(this->target); });
+    }
+    void wait()
+    {
+        this->strand.wait();
+    }
+
+private:
+    FluentType target;
+    Strand strand;
+};
+
+}
@@ -0,0 +1,99 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include "RTF_Executor.h"
+#include <algorithm>
+#include <new>
+
+namespace RTF {
+
+inline constexpr size_t matrix_alignment = 64;
+
+// A [register][device] matrix whose rows each start on a cache line, so a row can be fed straight to SIMD code.
+template <ValidAddressOrDataType DataType>
+class RegisterMatrix final
+{
+public:
+    RegisterMatrix() = default;
+    RegisterMatrix(size_t registers, size_t devices)
+    {
+        this->resize(registers, devices);
+    }
+
+    void resize(size_t registers, size_t devices)
+    {
+        constexpr size_t per_line = matrix_alignment / sizeof(DataType);
+        size_t const stride = (devices + per_line - 1) / per_line * per_line;
+        if (registers * stride > this->capacity) {
+            this->storage.reset(static_cast<DataType*>(::operator new(registers * stride * sizeof(DataType), std::align_val_t{ matrix_alignment })));
+            this->capacity = registers * stride;
+        }
+        std::fill_n(this->storage.get(), registers * stride, DataType{});
+        this->registers = registers;
+        this->devices = devices;
+        this->stride = stride;
+    }
+
+    [[nodiscard]] size_t registerCount() const { return this->registers; }
+    [[nodiscard]] size_t deviceCount() const { return this->devices; }
+    // Distance in elements between the start of two consecutive rows; always a multiple of the cache line size.
+    [[nodiscard]] size_t rowStride() const { return this->stride; }
+    [[nodiscard]] DataType* data() { return this->storage.get(); }
+    [[nodiscard]] DataType const* data() const { return this->storage.get(); }
+
+    [[nodiscard]] std::span<DataType> row(size_t reg) { return { this->storage.get() + (reg * this->stride), this->devices }; }
+    [[nodiscard]] std::span<DataType const> row(size_t reg) const { return { this->storage.get() + (reg * this->stride), this->devices }; }
+    [[nodiscard]] DataType& operator()(size_t reg, size_t dev) { return this->storage[(reg * this->stride) + dev]; }
+    [[nodiscard]] DataType operator()(size_t reg, size_t dev) const { return this->storage[(reg * this->stride) + dev]; }
+
+    // Scratch space for filling the matrix, kept with it so it is reused along with the rows.
+    [[nodiscard]] std::vector<DataType>& staging() { return this->staging_buffer; }
+
+private:
+    struct AlignedDelete
+    {
+        void operator()(DataType* p) const { ::operator delete(p, std::align_val_t{ matrix_alignment }); }
+    };
+    std::unique_ptr<DataType[], AlignedDelete> storage;
+    size_t capacity = 0;
+    size_t registers = 0;
+    size_t devices = 0;
+    size_t stride = 0;
+    std::vector<DataType> staging_buffer;
+};
+
+// Reads the same `addresses` from every target concurrently on `executor` and stores them in `out` as out(register, device).
+template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+void gatherCompRead(std::type_identity_t<std::span<IRegisterTarget<AddressType, DataType>* const>> targets, std::type_identity_t<std::span<AddressType const>> addresses, RegisterMatrix<DataType>& out, Executor& executor = Executor::getDefault())
+{
+    size_t const devices = targets.size();
+    size_t const registers = addresses.size();
+    out.resize(registers, devices);
+    if (devices == 0 || registers == 0)
+        return;
+
+    // Each target's compRead() needs a contiguous output span, so read [device][register] and transpose afterwards.
+    std::vector<DataType>& staging = out.staging();
+    staging.resize(devices * registers);
+    TaskGroup group(executor);
+    for (size_t dev = 0 ; dev < devices ; dev++) {
+        group.post(targets[dev]->getAffinityHint(), [&, dev] {
+            targets[dev]->compRead(addresses, std::span{ staging }.subspan(dev * registers, registers));
+        });
+    }
+    group.wait();
+
+    constexpr size_t block = 16;
+    for (size_t dev0 = 0 ; dev0 < devices ; dev0 += block) {
+        for (size_t reg0 = 0 ; reg0 < registers ; reg0 += block) {
+            for (size_t dev = dev0 ; dev < std::min(devices, dev0 + block) ; dev++) {
+                for (size_t reg = reg0 ; reg < std::min(registers, reg0 + block) ; reg++) {
+                    out(reg, dev) = staging[(dev * registers) + reg];
+                }
+            }
+        }
+    }
+}
+
+}
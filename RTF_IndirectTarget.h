@@ -0,0 +1,110 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include <optional>
+
+namespace RTF {
+
+// Exposes an internal memory that the parent target accesses through an address register and a data register.
+template <ValidAddressOrDataType AddressType_, ValidAddressOrDataType DataType_>
+class IndirectRegisterTarget : public IRegisterTarget<AddressType_, DataType_>
+{
+public:
+    using AddressType = AddressType_;
+    using DataType = DataType_;
+    using ParentType = IRegisterTarget<AddressType, DataType>;
+
+    // `auto_increment` is how far the hardware advances the internal address after each data register access, or 0 if it doesn't.
+    IndirectRegisterTarget(std::string_view name, OwnedOrViewedObject<ParentType> parent, AddressType addr_reg, AddressType data_reg, size_t auto_increment = 0)
+        : IRegisterTarget<AddressType, DataType>(name)
+        , parent(std::move(parent))
+        , addr_reg(addr_reg)
+        , data_reg(data_reg)
+        , auto_increment(auto_increment)
+    {}
+    virtual std::string_view getDomain() const override { return "IndirectRegisterTarget"; }
+    virtual size_t getAffinityHint() const override { return this->parent->getAffinityHint(); }
+
+    // Must be called if anything other than this target may have written the address register.
+    void invalidateAddressCache() { this->current_addr.reset(); }
+
+    virtual void write(AddressType addr, DataType data) override
+    {
+        this->setAddress(addr);
+        this->parent->write(this->data_reg, data);
+        this->advance(addr, 1);
+    }
+    [[nodiscard]] virtual DataType read(AddressType addr) override
+    {
+        this->setAddress(addr);
+        DataType const rv = this->parent->read(this->data_reg);
+        this->advance(addr, 1);
+        return rv;
+    }
+
+    virtual void seqWrite(AddressType start_addr, std::span<DataType const> data, size_t increment = sizeof(DataType)) override
+    {
+        if (!this->isBurst(increment))
+            return this->IRegisterTarget<AddressType, DataType>::seqWrite(start_addr, data, increment);
+        if (data.empty())
+            return;
+        this->setAddress(start_addr);
+        this->parent->fifoWrite(this->data_reg, data);
+        this->advance(start_addr, data.size());
+    }
+    virtual void seqRead(AddressType start_addr, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override
+    {
+        if (!this->isBurst(increment))
+            return this->IRegisterTarget<AddressType, DataType>::seqRead(start_addr, out_data, increment);
+        if (out_data.empty())
+            return;
+        this->setAddress(start_addr);
+        this->parent->fifoRead(this->data_reg, out_data);
+        this->advance(start_addr, out_data.size());
+    }
+
+    virtual void fifoWrite(AddressType fifo_addr, std::span<DataType const> data) override
+    {
+        // Without auto-increment the address only needs writing once; with it, every access needs a fresh address.
+        if (this->auto_increment != 0)
+            return this->IRegisterTarget<AddressType, DataType>::fifoWrite(fifo_addr, data);
+        this->setAddress(fifo_addr);
+        this->parent->fifoWrite(this->data_reg, data);
+        this->advance(fifo_addr, data.size());
+    }
+    virtual void fifoRead(AddressType fifo_addr, std::span<DataType> out_data) override
+    {
+        if (this->auto_increment != 0)
+            return this->IRegisterTarget<AddressType, DataType>::fifoRead(fifo_addr, out_data);
+        this->setAddress(fifo_addr);
+        this->parent->fifoRead(this->data_reg, out_data);
+        this->advance(fifo_addr, out_data.size());
+    }
+
+private:
+    [[nodiscard]] bool isBurst(size_t increment) const
+    {
+        return this->auto_increment != 0 && increment == this->auto_increment;
+    }
+    // Leaves the cached address unknown until advance() is called, so a failed data access forces the address to be rewritten.
+    void setAddress(AddressType addr)
+    {
+        bool const cached = (this->current_addr == addr);
+        this->current_addr.reset();
+        if (!cached)
+            this->parent->write(this->addr_reg, static_cast<DataType>(addr));
+    }
+    void advance(AddressType addr, size_t accesses)
+    {
+        this->current_addr = static_cast<AddressType>(addr + (this->auto_increment * accesses));
+    }
+
+    OwnedOrViewedObject<ParentType> parent;
+    AddressType const addr_reg;
+    AddressType const data_reg;
+    size_t const auto_increment;
+    std::optional<AddressType> current_addr;
+};
+
+}
@@ -0,0 +1,139 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include <bit>
+#include <functional>
+#include <limits>
+
+namespace RTF {
+
+template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+class InterruptDispatcher
+{
+public:
+    using TargetType = IRegisterTarget<AddressType, DataType>;
+    using HandlerType = std::function<void(AddressType status_addr, unsigned bit)>;
+    using NodeId = size_t;
+    static constexpr NodeId no_parent = std::numeric_limits<NodeId>::max();
+    static constexpr unsigned bits = sizeof(DataType) * 8;
+
+    explicit InterruptDispatcher(TargetType& target) : target(target) {}
+
+    // Adds a status register.  If `parent` is given, this register is only read when bit `parent_bit` of the parent (summary) register is set.
+    // `w1c` registers have their serviced bits acknowledged by writing them back as ones.
+    NodeId addStatusRegister(AddressType status_addr, bool w1c = true, NodeId parent = no_parent, unsigned parent_bit = 0)
+    {
+        assert(parent == no_parent || (parent < this->nodes.size() && parent_bit < bits));
+        NodeId const id = this->nodes.size();
+        this->nodes.push_back(Node{ status_addr, w1c });
+        if (parent == no_parent)
+            this->roots.push_back(id);
+        else
+            this->nodes[parent].children.emplace_back(parent_bit, id);
+        return id;
+    }
+    void setHandler(NodeId node, unsigned bit, HandlerType handler)
+    {
+        assert(node < this->nodes.size() && bit < bits);
+        this->nodes[node].handlers[bit] = std::move(handler);
+    }
+    // Only bits in `mask` are dispatched and acknowledged; the default is all bits.
+    void setEnableMask(NodeId node, DataType mask)
+    {
+        this->nodes[node].enable_mask = mask;
+    }
+
+    // Reads the status tree one level at a time (one compRead() per level), calls the handlers for every pending leaf bit,
+    // then acknowledges every serviced W1C register with one compWrite(), leaves before summaries (also when a handler throws).
+    // Returns the number of handlers called.
+    size_t service()
+    {
+        size_t handled = 0;
+        this->acks.clear();
+        this->level.assign(this->roots.begin(), this->roots.end());
+        this->ack_levels.clear();
+        while (!this->level.empty()) {
+            this->addresses.clear();
+            for (NodeId const id : this->level) {
+                this->addresses.push_back(this->nodes[id].status_addr);
+            }
+            this->values.resize(this->addresses.size());
+            this->target.compRead(this->addresses, this->values);
+
+            this->next_level.clear();
+            this->ack_levels.push_back(this->acks.size());
+            for (size_t n = 0 ; n < this->level.size() ; n++) {
+                Node& node = this->nodes[this->level[n]];
+                DataType const pending = this->values[n] & node.enable_mask;
+                if (pending == 0)
+                    continue;
+                for (auto const& [bit, child] : node.children) {
+                    if (pending & (DataType{1} << bit))
+                        this->next_level.push_back(child);
+                }
+                DataType serviced = 0;
+                try {
+                    for (DataType remaining = pending ; remaining != 0 ; remaining &= static_cast<DataType>(remaining - 1)) {
+                        unsigned const bit = static_cast<unsigned>(std::countr_zero(remaining));
+                        serviced |= DataType{1} << bit;
+                        if (node.handlers[bit]) {
+                            node.handlers[bit](node.status_addr, bit);
+                            handled++;
+                        }
+                    }
+                }
+                catch (...) {
+                    // Still ack what was serviced, including the bit whose handler threw, so it doesn't fire again straight away.
+                    if (node.w1c)
+                        this->acks.emplace_back(node.status_addr, serviced);
+                    this->writeAcks();
+                    throw;
+                }
+                if (node.w1c)
+                    this->acks.emplace_back(node.status_addr, pending);
+            }
+            std::swap(this->level, this->next_level);
+        }
+        this->writeAcks();
+        return handled;
+    }
+
+private:
+    struct Node
+    {
+        AddressType status_addr;
+        bool w1c;
+        DataType enable_mask = static_cast<DataType>(~DataType{0});
+        std::vector<std::pair<unsigned, NodeId>> children = {};
+        std::vector<HandlerType> handlers = std::vector<HandlerType>(bits);
+    };
+
+    void writeAcks()
+    {
+        if (this->acks.empty())
+            return;
+        // Reverse the order of levels so leaf acks precede the summary acks that latch them.
+        this->ordered_acks.clear();
+        size_t end = this->acks.size();
+        for (size_t l = this->ack_levels.size() ; l-- > 0 ; ) {
+            this->ordered_acks.insert(this->ordered_acks.end(), this->acks.begin() + this->ack_levels[l], this->acks.begin() + end);
+            end = this->ack_levels[l];
+        }
+        this->target.compWrite(this->ordered_acks);
+    }
+
+    TargetType& target;
+    std::vector<Node> nodes;
+    std::vector<NodeId> roots;
+    // Scratch buffers, kept to avoid allocating in service()
+    std::vector<NodeId> level;
+    std::vector<NodeId> next_level;
+    std::vector<AddressType> addresses;
+    std::vector<DataType> values;
+    std::vector<std::pair<AddressType, DataType>> acks;
+    std::vector<std::pair<AddressType, DataType>> ordered_acks;
+    std::vector<size_t> ack_levels;
+};
+
+}
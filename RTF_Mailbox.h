@@ -0,0 +1,179 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include <unordered_map>
+
+namespace RTF {
+
+template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+struct MailboxLayout
+{
+    AddressType args_addr;          // first argument register; arguments are written with one seqWrite()
+    AddressType doorbell_addr;
+    DataType doorbell_value;
+    AddressType status_addr;
+    DataType done_mask;             // the command is complete when (status & done_mask) == done_value
+    DataType done_value;
+    AddressType response_addr;      // first response register; the response is read with one seqRead()
+    DataType done_clear = 0;        // if non-zero, written to status_addr after the response is read
+};
+
+class MailboxTimeoutException : public std::runtime_error
+{
+public:
+    MailboxTimeoutException(uint64_t ticket)
+        : std::runtime_error(std::format("Mailbox command {} timed out!", ticket))
+    {}
+};
+
+class MailboxBusyException : public std::runtime_error
+{
+public:
+    MailboxBusyException()
+        : std::runtime_error("No mailbox became free in time!")
+    {}
+};
+
+// Runs commands over a set of register mailboxes, keeping up to one command in flight per mailbox.
+// Completion of every in-flight command is checked with a single compRead() per poll.
+template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+class MailboxEngine
+{
+public:
+    using LayoutType = MailboxLayout<AddressType, DataType>;
+    using Ticket = uint64_t;
+
+    MailboxEngine(FluentRegisterTarget<AddressType, DataType> target, std::vector<LayoutType> mailboxes)
+        : target(std::move(target))
+        , mailboxes(std::move(mailboxes))
+        , slots(this->mailboxes.size())
+    {
+        assert(!this->mailboxes.empty());
+    }
+
+    // Starts a command on a free mailbox, first waiting (with `poller`) for one to free up if they are all busy.
+    template <CPoller PollerType>
+    Ticket submit(PollerType const& poller, std::span<DataType const> args, size_t response_count)
+    {
+        size_t slot_index = this->freeSlot();
+        if (slot_index == this->slots.size()) {
+            if (!poller([&] { this->poll(); return (slot_index = this->freeSlot()) != this->slots.size(); }))
+                throw MailboxBusyException();
+        }
+        LayoutType const& mb = this->mailboxes[slot_index];
+        Slot& slot = this->slots[slot_index];
+        Ticket const ticket = this->next_ticket++;
+        if (!args.empty())
+            this->target.seqWrite(mb.args_addr, args, sizeof(DataType), "Mailbox Args");
+        this->target.write(mb.doorbell_addr, mb.doorbell_value, "Mailbox Doorbell");
+        slot = Slot{ true, false, ticket, response_count };
+        return ticket;
+    }
+    Ticket submit(std::span<DataType const> args, size_t response_count)
+    {
+        return this->submit(default_poller, args, response_count);
+    }
+
+    // Checks every in-flight command once and collects the responses of the ones that have completed.
+    void poll()
+    {
+        this->busy_indices.clear();
+        this->status_addresses.clear();
+        for (size_t i = 0 ; i < this->slots.size() ; i++) {
+            if (this->slots[i].busy) {
+                this->busy_indices.push_back(i);
+                this->status_addresses.push_back(this->mailboxes[i].status_addr);
+            }
+        }
+        if (this->busy_indices.empty())
+            return;
+        this->status_values.resize(this->status_addresses.size());
+        this->target.compRead(this->status_addresses, this->status_values, "Mailbox Status");
+        for (size_t n = 0 ; n < this->busy_indices.size() ; n++) {
+            LayoutType const& mb = this->mailboxes[this->busy_indices[n]];
+            if ((this->status_values[n] & mb.done_mask) != (mb.done_value & mb.done_mask))
+                continue;
+            Slot& slot = this->slots[this->busy_indices[n]];
+            std::vector<DataType> response(slot.response_count);
+            if (!response.empty())
+                this->target.seqRead(mb.response_addr, response, sizeof(DataType), "Mailbox Response");
+            if (mb.done_clear != 0)
+                this->target.write(mb.status_addr, mb.done_clear, "Mailbox Done Clear");
+            if (!slot.discard)
+                this->completed.emplace(slot.ticket, std::move(response));
+            slot.busy = false;
+        }
+    }
+
+    [[nodiscard]] bool isComplete(Ticket ticket) const
+    {
+        return this->completed.contains(ticket);
+    }
+    // Drops the response of a command nobody will wait() for, now if it has completed or else when it does.
+    void discard(Ticket ticket)
+    {
+        if (this->completed.erase(ticket) != 0)
+            return;
+        for (Slot& slot : this->slots) {
+            if (slot.busy && slot.ticket == ticket)
+                slot.discard = true;
+        }
+    }
+
+    // Waits for `ticket` to complete and returns its response.  Other in-flight commands are collected along the way.
+    template <CPoller PollerType>
+    std::vector<DataType> wait(PollerType const& poller, Ticket ticket)
+    {
+        auto it = this->completed.find(ticket);
+        if (it == this->completed.end()) {
+            if (!poller([&] { this->poll(); return (it = this->completed.find(ticket)) != this->completed.end(); }))
+                throw MailboxTimeoutException(ticket);
+        }
+        std::vector<DataType> rv = std::move(it->second);
+        this->completed.erase(it);
+        return rv;
+    }
+    std::vector<DataType> wait(Ticket ticket)
+    {
+        return this->wait(default_poller, ticket);
+    }
+
+    std::vector<DataType> call(std::span<DataType const> args, size_t response_count)
+    {
+        return this->wait(this->submit(args, response_count));
+    }
+    std::vector<DataType> call(std::initializer_list<DataType const> args, size_t response_count)
+    {
+        return this->call(std::span{ args.begin(), args.end() }, response_count);
+    }
+
+private:
+    struct Slot
+    {
+        bool busy = false;
+        bool discard = false;
+        Ticket ticket = 0;
+        size_t response_count = 0;
+    };
+
+    [[nodiscard]] size_t freeSlot() const
+    {
+        for (size_t i = 0 ; i < this->slots.size() ; i++) {
+            if (!this->slots[i].busy)
+                return i;
+        }
+        return this->slots.size();
+    }
+
+    FluentRegisterTarget<AddressType, DataType> target;
+    std::vector<LayoutType> mailboxes;
+    std::vector<Slot> slots;
+    Ticket next_ticket = 1;
+    std::unordered_map<Ticket, std::vector<DataType>> completed;
+    std::vector<size_t> busy_indices;
+    std::vector<AddressType> status_addresses;
+    std::vector<DataType> status_values;
+};
+
+}
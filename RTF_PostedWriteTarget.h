@@ -0,0 +1,288 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include <algorithm>
+#include <bit>
+
+namespace RTF {
+
+template <ValidAddressOrDataType AddressType_, ValidAddressOrDataType DataType_>
+class PostedWriteRegisterTarget : public PassthroughRegisterTarget<AddressType_, DataType_>
+{
+public:
+    using AddressType = AddressType_;
+    using DataType = DataType_;
+
+    template <typename ParentArg>
+    PostedWriteRegisterTarget(ParentArg&& parent, size_t max_pending = 64)
+        : PassthroughRegisterTarget<AddressType, DataType>(std::forward<ParentArg>(parent))
+        , max_pending(std::max<size_t>(max_pending, 1))
+        , hazards(std::bit_ceil(this->max_pending * 2))
+    {
+        this->pending.reserve(this->max_pending);
+    }
+    virtual ~PostedWriteRegisterTarget()
+    {
+        try {
+            this->flush();
+        }
+        catch (...) {
+            // Destructors can't report errors; call flush() explicitly to observe them.
+        }
+    }
+
+    // Declares registers in [first_addr, last_addr] as non-volatile: reading them has no side effects and returns the last value written.
+    // Writes to these registers are coalesced while queued and reads of them are forwarded from the queue instead of flushing it.
+    void addNonVolatileRange(AddressType first_addr, AddressType last_addr)
+    {
+        assert(first_addr <= last_addr);
+        // isNonVolatile() only checks the nearest range starting at or below an address, so overlapping ranges are merged.
+        auto it = std::upper_bound(this->non_volatile.begin(), this->non_volatile.end(), first_addr, [](AddressType a, auto const& r) { return a < r.first; });
+        if (it != this->non_volatile.begin() && std::prev(it)->second >= first_addr) {
+            --it;
+            first_addr = it->first;
+        }
+        auto last = it;
+        for ( ; last != this->non_volatile.end() && last->first <= last_addr ; ++last) {
+            last_addr = std::max(last_addr, last->second);
+        }
+        it = this->non_volatile.erase(it, last);
+        this->non_volatile.insert(it, { first_addr, last_addr });
+    }
+
+    void flush()
+    {
+        if (this->pending.empty())
+            return;
+        // Clear the queue even if the parent throws, so a failed batch isn't re-sent by the next flush.
+        auto const clear_pending = [this] {
+            this->pending.clear();
+            this->volatile_end = 0;
+            if (++this->generation == 0) {
+                std::fill(this->hazards.begin(), this->hazards.end(), HazardSlot{});
+                this->generation = 1;
+            }
+        };
+        try {
+            this->getParent().compWrite(this->pending);
+        }
+        catch (...) {
+            clear_pending();
+            throw;
+        }
+        clear_pending();
+    }
+    [[nodiscard]] size_t getPendingCount() const { return this->pending.size(); }
+
+    virtual void write(AddressType addr, DataType data) override
+    {
+        this->post(addr, data);
+    }
+    [[nodiscard]] virtual DataType read(AddressType addr) override
+    {
+        if (!this->isNonVolatile(addr)) {
+            this->flush();
+            return this->getParent().read(addr);
+        }
+        if (auto const* slot = this->findHazard(addr))
+            return this->pending[slot->index].second;
+        return this->getParent().read(addr);
+    }
+    virtual void readModifyWrite(AddressType addr, DataType new_data, DataType mask) override
+    {
+        if (!this->isNonVolatile(addr)) {
+            this->flush();
+            return this->getParent().readModifyWrite(addr, new_data, mask);
+        }
+        DataType v = this->read(addr);
+        v &= ~mask;
+        v |= new_data & mask;
+        this->post(addr, v);
+    }
+    [[nodiscard]] virtual DataType writeReadBack(AddressType addr, DataType data) override
+    {
+        this->flush();
+        return this->getParent().writeReadBack(addr, data);
+    }
+    virtual bool pollRead(AddressType addr, DataType expected, DataType mask, BasicPoller const& poller, DataType& out_data) override
+    {
+        this->flush();
+        return this->getParent().pollRead(addr, expected, mask, poller, out_data);
+    }
+    virtual SequenceResult<DataType> executeSequence(RegisterSequence<AddressType, DataType> const& sequence) override
+    {
+        this->flush();
+        return this->getParent().executeSequence(sequence);
+    }
+
+    virtual void seqWrite(AddressType start_addr, std::span<DataType const> data, size_t increment = sizeof(DataType)) override
+    {
+        this->flush();
+        this->getParent().seqWrite(start_addr, data, increment);
+    }
+    virtual void seqRead(AddressType start_addr, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override
+    {
+        this->flush();
+        this->getParent().seqRead(start_addr, out_data, increment);
+    }
+    virtual void seqFill(AddressType start_addr, DataType value, size_t count, size_t increment = sizeof(DataType)) override
+    {
+        this->flush();
+        this->getParent().seqFill(start_addr, value, count, increment);
+    }
+    virtual void seqReadModifyWrite(AddressType start_addr, DataType new_data, DataType mask, size_t count, size_t increment = sizeof(DataType)) override
+    {
+        this->flush();
+        this->getParent().seqReadModifyWrite(start_addr, new_data, mask, count, increment);
+    }
+    virtual void blockWrite(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType const> data, size_t increment = sizeof(DataType)) override
+    {
+        this->flush();
+        this->getParent().blockWrite(start_addr, rows, row_stride, data, increment);
+    }
+    virtual void blockRead(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override
+    {
+        this->flush();
+        this->getParent().blockRead(start_addr, rows, row_stride, out_data, increment);
+    }
+    virtual void fifoWrite(AddressType fifo_addr, std::span<DataType const> data) override
+    {
+        this->flush();
+        this->getParent().fifoWrite(fifo_addr, data);
+    }
+    virtual void fifoRead(AddressType fifo_addr, std::span<DataType> out_data) override
+    {
+        this->flush();
+        this->getParent().fifoRead(fifo_addr, out_data);
+    }
+
+    virtual void compWrite(std::span<std::pair<AddressType, DataType> const> addr_data) override
+    {
+        for (auto const& ad : addr_data) {
+            this->post(ad.first, ad.second);
+        }
+    }
+    virtual void compWrite(std::span<AddressType const> const addresses, std::span<DataType const> data) override
+    {
+        assert(addresses.size() == data.size());
+        for (size_t i = 0 ; i < addresses.size() ; i++) {
+            this->post(addresses[i], data[i]);
+        }
+    }
+    virtual void compRead(std::span<AddressType const> const addresses, std::span<DataType> out_data) override
+    {
+        assert(addresses.size() == out_data.size());
+        bool const all_non_volatile = std::all_of(addresses.begin(), addresses.end(), [this](AddressType a) { return this->isNonVolatile(a); });
+        if (!all_non_volatile || this->pending.empty()) {
+            this->flush();
+            return this->getParent().compRead(addresses, out_data);
+        }
+        // Forward what we can from the queue and read only the remainder from the parent
+        this->miss_addresses.clear();
+        this->miss_indices.clear();
+        for (size_t i = 0 ; i < addresses.size() ; i++) {
+            if (auto const* slot = this->findHazard(addresses[i])) {
+                out_data[i] = this->pending[slot->index].second;
+            }
+            else {
+                this->miss_addresses.push_back(addresses[i]);
+                this->miss_indices.push_back(i);
+            }
+        }
+        if (this->miss_addresses.empty())
+            return;
+        this->miss_data.resize(this->miss_addresses.size());
+        this->getParent().compRead(this->miss_addresses, this->miss_data);
+        for (size_t i = 0 ; i < this->miss_indices.size() ; i++) {
+            out_data[this->miss_indices[i]] = this->miss_data[i];
+        }
+    }
+
+private:
+    struct HazardSlot
+    {
+        AddressType addr = {};
+        uint32_t generation = 0;
+        uint32_t index = 0;
+    };
+
+    [[nodiscard]] bool isNonVolatile(AddressType addr) const
+    {
+        auto it = std::upper_bound(this->non_volatile.begin(), this->non_volatile.end(), addr, [](AddressType a, auto const& r) { return a < r.first; });
+        if (it == this->non_volatile.begin())
+            return false;
+        --it;
+        return addr <= it->second;
+    }
+
+    [[nodiscard]] size_t hashSlot(AddressType addr) const
+    {
+        // Fibonacci hashing; register addresses are usually aligned so the low bits alone are poorly distributed.
+        return static_cast<size_t>((static_cast<uint64_t>(addr) * 0x9E3779B97F4A7C15ull) >> 32) & (this->hazards.size() - 1);
+    }
+    [[nodiscard]] HazardSlot const* findHazard(AddressType addr) const
+    {
+        for (size_t i = this->hashSlot(addr) ; ; i = (i + 1) & (this->hazards.size() - 1)) {
+            HazardSlot const& slot = this->hazards[i];
+            if (slot.generation != this->generation)
+                return nullptr;
+            if (slot.addr == addr)
+                return &slot;
+        }
+    }
+
+    void post(AddressType addr, DataType data)
+    {
+        bool const coalesce = this->isNonVolatile(addr);
+        size_t i = this->hashSlot(addr);
+        for ( ; ; i = (i + 1) & (this->hazards.size() - 1)) {
+            HazardSlot& slot = this->hazards[i];
+            if (slot.generation != this->generation)
+                break;
+            if (slot.addr == addr) {
+                // Overwriting the queued write in place would move it ahead of any volatile write queued since, so only do that if there is none.
+                if (coalesce && slot.index >= this->volatile_end) {
+                    this->pending[slot.index].second = data;
+                    return;
+                }
+                // Otherwise keep every write, in order; the slot tracks the most recent one.
+                slot.index = static_cast<uint32_t>(this->pending.size());
+                return this->append(addr, data, coalesce);
+            }
+        }
+        this->hazards[i] = { addr, this->generation, static_cast<uint32_t>(this->pending.size()) };
+        this->append(addr, data, coalesce);
+    }
+    void append(AddressType addr, DataType data, bool non_volatile_addr)
+    {
+        this->pending.emplace_back(addr, data);
+        if (!non_volatile_addr)
+            this->volatile_end = this->pending.size();
+        this->flushIfFull();
+    }
+    void flushIfFull()
+    {
+        if (this->pending.size() >= this->max_pending)
+            this->flush();
+    }
+
+    size_t const max_pending;
+    std::vector<std::pair<AddressType, DataType>> pending;
+    std::vector<HazardSlot> hazards;
+    uint32_t generation = 1;
+    size_t volatile_end = 0;    // one past the last volatile write in `pending`
+    std::vector<std::pair<AddressType, AddressType>> non_volatile;
+    std::vector<AddressType> miss_addresses;
+    std::vector<size_t> miss_indices;
+    std::vector<DataType> miss_data;
+};
+
+template <typename T>
+PostedWriteRegisterTarget(std::shared_ptr<T>, size_t = 64) -> PostedWriteRegisterTarget<typename T::AddressType, typename T::DataType>;
+template <typename T>
+PostedWriteRegisterTarget(std::unique_ptr<T>, size_t = 64) -> PostedWriteRegisterTarget<typename T::AddressType, typename T::DataType>;
+template <typename T>
+PostedWriteRegisterTarget(T&, size_t = 64) -> PostedWriteRegisterTarget<typename T::AddressType, typename T::DataType>;
+
+}
@@ -0,0 +1,615 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include <cstring>
+#include <mutex>
+
+// The largest message, or buffer sized by a message, that either end accepts from its peer, so a corrupt length can't exhaust memory.
+#ifndef RTF_REMOTE_MAX_MESSAGE_BYTES
+#define RTF_REMOTE_MAX_MESSAGE_BYTES (size_t{ 256 } << 20)
+#endif
+
+namespace RTF {
+
+inline constexpr size_t max_message_bytes = RTF_REMOTE_MAX_MESSAGE_BYTES;
+
+// The wire protocol between RemoteRegisterTarget and RegisterServer.
+// Values are in native byte order, so both ends must run on the same architecture and agree on AddressType and DataType.
+enum class RemoteOp : uint8_t
+{
+    Write, Read, ReadModifyWrite, WriteReadBack, PollRead,
+    SeqWrite, SeqRead, SeqFill, SeqReadModifyWrite, BlockWrite, BlockRead,
+    FifoWrite, FifoRead, CompWrite, CompRead, ExecuteSequence,
+};
+enum class RemoteStatus : uint8_t
+{
+    Ok,
+    Error,          // followed by the error message
+    VerifyFailure,  // ExecuteSequence only: the failed operation's verify or poll didn't match
+};
+
+class RemoteTargetException : public std::runtime_error
+{
+public:
+    RemoteTargetException(std::string const& msg)
+        : std::runtime_error(msg)
+    {}
+};
+
+class MessageWriter
+{
+public:
+    // Starts a new message in `buffer`, or adds to the one already there if `append` is set.
+    explicit MessageWriter(std::vector<std::byte>& buffer, bool append = false)
+        : buffer(buffer)
+    {
+        if (!append)
+            this->buffer.clear();
+    }
+
+    template <typename T>
+        requires std::is_trivially_copyable_v<T>
+    MessageWriter& put(T const& value)
+    {
+        return this->putBytes(std::as_bytes(std::span{ &value, 1 }));
+    }
+    template <typename T>
+        requires std::is_trivially_copyable_v<T>
+    MessageWriter& putSpan(std::span<T const> values)
+    {
+        this->put<uint64_t>(values.size());
+        return this->putBytes(std::as_bytes(values));
+    }
+    MessageWriter& putDuration(std::chrono::microseconds d)
+    {
+        return this->put<int64_t>(d.count());
+    }
+    MessageWriter& putString(std::string_view s)
+    {
+        return this->putSpan(std::span{ s.data(), s.size() });
+    }
+    MessageWriter& putBytes(std::span<std::byte const> bytes)
+    {
+        this->buffer.insert(this->buffer.end(), bytes.begin(), bytes.end());
+        return *this;
+    }
+
+private:
+    std::vector<std::byte>& buffer;
+};
+
+class MessageReader
+{
+public:
+    explicit MessageReader(std::span<std::byte const> message) : message(message) {}
+
+    template <typename T>
+        requires std::is_trivially_copyable_v<T>
+    T get()
+    {
+        T value;
+        std::memcpy(&value, this->take(sizeof(T)).data(), sizeof(T));
+        return value;
+    }
+    // Reads a span into `out`, which must be exactly the size that was sent.
+    template <typename T>
+        requires std::is_trivially_copyable_v<T>
+    void getSpan(std::span<T> out)
+    {
+        if (this->get<uint64_t>() != out.size())
+            throw RemoteTargetException("Remote message span size mismatch!");
+        std::memcpy(out.data(), this->take(out.size_bytes()).data(), out.size_bytes());
+    }
+    template <typename T>
+        requires std::is_trivially_copyable_v<T>
+    std::vector<T> getVector()
+    {
+        uint64_t const count = this->get<uint64_t>();
+        if (count > this->remaining() / std::max<size_t>(sizeof(T), 1))
+            throw RemoteTargetException("Truncated remote message!");
+        std::vector<T> rv(count);
+        std::memcpy(rv.data(), this->take(count * sizeof(T)).data(), count * sizeof(T));
+        return rv;
+    }
+    // Reads the number of elements of a buffer the receiver allocates itself, which must fit in max_message_bytes.
+    template <typename T>
+    size_t getCount()
+    {
+        uint64_t const count = this->get<uint64_t>();
+        if (count > max_message_bytes / std::max<size_t>(sizeof(T), 1))
+            throw RemoteTargetException("Remote message too large!");
+        return static_cast<size_t>(count);
+    }
+    // Returns a view of a length-prefixed block of bytes, without copying it.
+    std::span<std::byte const> getBytes()
+    {
+        return this->take(this->get<uint64_t>());
+    }
+    std::chrono::microseconds getDuration()
+    {
+        return std::chrono::microseconds(this->get<int64_t>());
+    }
+    std::string getString()
+    {
+        uint64_t const count = this->get<uint64_t>();
+        auto const bytes = this->take(count);
+        return std::string(reinterpret_cast<char const*>(bytes.data()), bytes.size());
+    }
+    [[nodiscard]] size_t remaining() const { return this->message.size() - this->offset; }
+
+private:
+    std::span<std::byte const> take(size_t count)
+    {
+        if (count > this->remaining())
+            throw RemoteTargetException("Truncated remote message!");
+        auto const rv = this->message.subspan(this->offset, count);
+        this->offset += count;
+        return rv;
+    }
+
+    std::span<std::byte const> message;
+    size_t offset = 0;
+};
+
+// Carries request messages to a RegisterServer and brings back its responses.
+struct IRemoteTransport
+{
+protected:
+    IRemoteTransport() = default;
+public:
+    virtual ~IRemoteTransport() = default;
+
+    // Sends one request and waits for its response.  Called by one thread at a time.
+    virtual void transact(std::span<std::byte const> request, std::vector<std::byte>& response) = 0;
+
+    // Sends a request made of `request_parts` (such as a header and the caller's data, sent without first joining them) and waits for its response.
+    // If the response ends in a bulk payload of exactly `response_payload.size()` bytes, a transport may receive that straight into `response_payload`,
+    // leave only the rest in `response`, and return true.
+    // The base class implementation joins the parts and calls transact() above, so it never scatters.
+    virtual bool transact(std::span<std::span<std::byte const> const> request_parts, std::vector<std::byte>& response, [[maybe_unused]] std::span<std::byte> response_payload)
+    {
+        this->gather_buffer.clear();
+        for (auto const part : request_parts) {
+            this->gather_buffer.insert(this->gather_buffer.end(), part.begin(), part.end());
+        }
+        this->transact(this->gather_buffer, response);
+        return false;
+    }
+
+protected:
+    std::vector<std::byte> gather_buffer;
+};
+
+// Executes requests from RemoteRegisterTargets against a local target.
+template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+class RegisterServer
+{
+public:
+    using TargetType = IRegisterTarget<AddressType, DataType>;
+    using SequenceType = RegisterSequence<AddressType, DataType>;
+
+    explicit RegisterServer(TargetType& target) : target(target) {}
+
+    // Handles one request.  Errors from the target are returned to the client rather than thrown.
+    void handle(std::span<std::byte const> request, std::vector<std::byte>& response)
+    {
+        std::span<std::byte const> payload;
+        this->handle(request, response, payload);
+        response.insert(response.end(), payload.begin(), payload.end());
+    }
+    // As above, but the response's bulk payload (if any) is left in the server's buffer as `response_payload`, to be sent after `response`.
+    // It stays valid until the next request is handled.
+    void handle(std::span<std::byte const> request, std::vector<std::byte>& response, std::span<std::byte const>& response_payload)
+    {
+        MessageWriter w(response);
+        response_payload = {};
+        try {
+            MessageReader r(request);
+            this->dispatch(r, w, response_payload);
+        }
+        catch (std::exception const& ex) {
+            MessageWriter(response).put(RemoteStatus::Error).putString(ex.what());
+            response_payload = {};
+        }
+    }
+
+private:
+    void dispatch(MessageReader& r, MessageWriter& w, std::span<std::byte const>& payload)
+    {
+        auto const op = r.get<RemoteOp>();
+        switch (op) {
+        case RemoteOp::Write: {
+            auto const addr = r.get<AddressType>();
+            auto const data = r.get<DataType>();
+            this->target.write(addr, data);
+            w.put(RemoteStatus::Ok);
+            return;
+        }
+        case RemoteOp::Read: {
+            auto const addr = r.get<AddressType>();
+            DataType const data = this->target.read(addr);
+            w.put(RemoteStatus::Ok).put(data);
+            return;
+        }
+        case RemoteOp::ReadModifyWrite: {
+            auto const addr = r.get<AddressType>();
+            auto const new_data = r.get<DataType>();
+            auto const mask = r.get<DataType>();
+            this->target.readModifyWrite(addr, new_data, mask);
+            w.put(RemoteStatus::Ok);
+            return;
+        }
+        case RemoteOp::WriteReadBack: {
+            auto const addr = r.get<AddressType>();
+            auto const data = r.get<DataType>();
+            DataType const rv = this->target.writeReadBack(addr, data);
+            w.put(RemoteStatus::Ok).put(rv);
+            return;
+        }
+        case RemoteOp::PollRead: {
+            auto const addr = r.get<AddressType>();
+            auto const expected = r.get<DataType>();
+            auto const mask = r.get<DataType>();
+            BasicPoller const poller = getPoller(r);
+            DataType value = {};
+            bool const success = this->target.pollRead(addr, expected, mask, poller, value);
+            w.put(RemoteStatus::Ok).put(success).put(value);
+            return;
+        }
+        case RemoteOp::SeqWrite: {
+            auto const start_addr = r.get<AddressType>();
+            auto const increment = r.get<uint64_t>();
+            this->data = r.getVector<DataType>();
+            this->target.seqWrite(start_addr, this->data, increment);
+            w.put(RemoteStatus::Ok);
+            return;
+        }
+        case RemoteOp::SeqRead: {
+            auto const start_addr = r.get<AddressType>();
+            auto const increment = r.get<uint64_t>();
+            this->data.resize(r.getCount<DataType>());
+            this->target.seqRead(start_addr, this->data, increment);
+            w.put(RemoteStatus::Ok).put<uint64_t>(this->data.size());
+            payload = std::as_bytes(std::span{ this->data });
+            return;
+        }
+        case RemoteOp::SeqFill: {
+            auto const start_addr = r.get<AddressType>();
+            auto const value = r.get<DataType>();
+            auto const count = r.get<uint64_t>();
+            auto const increment = r.get<uint64_t>();
+            this->target.seqFill(start_addr, value, count, increment);
+            w.put(RemoteStatus::Ok);
+            return;
+        }
+        case RemoteOp::SeqReadModifyWrite: {
+            auto const start_addr = r.get<AddressType>();
+            auto const new_data = r.get<DataType>();
+            auto const mask = r.get<DataType>();
+            // The default seqReadModifyWrite() buffers `count` registers, so bound it like any other buffer the peer sizes.
+            auto const count = r.getCount<DataType>();
+            auto const increment = r.get<uint64_t>();
+            this->target.seqReadModifyWrite(start_addr, new_data, mask, count, increment);
+            w.put(RemoteStatus::Ok);
+            return;
+        }
+        case RemoteOp::BlockWrite: {
+            auto const start_addr = r.get<AddressType>();
+            auto const rows = r.get<uint64_t>();
+            auto const row_stride = r.get<uint64_t>();
+            auto const increment = r.get<uint64_t>();
+            this->data = r.getVector<DataType>();
+            checkRows(rows, this->data.size());
+            this->target.blockWrite(start_addr, rows, row_stride, this->data, increment);
+            w.put(RemoteStatus::Ok);
+            return;
+        }
+        case RemoteOp::BlockRead: {
+            auto const start_addr = r.get<AddressType>();
+            auto const rows = r.get<uint64_t>();
+            auto const row_stride = r.get<uint64_t>();
+            auto const increment = r.get<uint64_t>();
+            this->data.resize(r.getCount<DataType>());
+            checkRows(rows, this->data.size());
+            this->target.blockRead(start_addr, rows, row_stride, this->data, increment);
+            w.put(RemoteStatus::Ok).put<uint64_t>(this->data.size());
+            payload = std::as_bytes(std::span{ this->data });
+            return;
+        }
+        case RemoteOp::FifoWrite: {
+            auto const fifo_addr = r.get<AddressType>();
+            this->data = r.getVector<DataType>();
+            this->target.fifoWrite(fifo_addr, this->data);
+            w.put(RemoteStatus::Ok);
+            return;
+        }
+        case RemoteOp::FifoRead: {
+            auto const fifo_addr = r.get<AddressType>();
+            this->data.resize(r.getCount<DataType>());
+            this->target.fifoRead(fifo_addr, this->data);
+            w.put(RemoteStatus::Ok).put<uint64_t>(this->data.size());
+            payload = std::as_bytes(std::span{ this->data });
+            return;
+        }
+        case RemoteOp::CompWrite: {
+            this->addresses = r.getVector<AddressType>();
+            this->data = r.getVector<DataType>();
+            if (this->addresses.size() != this->data.size())
+                throw RemoteTargetException("CompWrite address/data size mismatch!");
+            this->target.compWrite(std::span<AddressType const>{ this->addresses }, std::span<DataType const>{ this->data });
+            w.put(RemoteStatus::Ok);
+            return;
+        }
+        case RemoteOp::CompRead: {
+            this->addresses = r.getVector<AddressType>();
+            this->data.resize(this->addresses.size());
+            this->target.compRead(this->addresses, this->data);
+            w.put(RemoteStatus::Ok).put<uint64_t>(this->data.size());
+            payload = std::as_bytes(std::span{ this->data });
+            return;
+        }
+        case RemoteOp::ExecuteSequence: {
+            SequenceType const sequence = getSequence(r);
+            SequenceResult<DataType> const result = this->target.executeSequence(sequence);
+            RemoteStatus status = RemoteStatus::Ok;
+            std::string message;
+            if (result.error) {
+                try {
+                    std::rethrow_exception(result.error);
+                }
+                catch (WriteVerifyFailureException const& ex) { status = RemoteStatus::VerifyFailure; message = ex.what(); }
+                catch (ReadVerifyFailureException const& ex) { status = RemoteStatus::VerifyFailure; message = ex.what(); }
+                catch (PollReadTimeoutException const& ex) { status = RemoteStatus::VerifyFailure; message = ex.what(); }
+                catch (std::exception const& ex) { status = RemoteStatus::Error; message = ex.what(); }
+                catch (...) { status = RemoteStatus::Error; message = "Unknown error"; }
+            }
+            w.put(RemoteStatus::Ok).put<uint64_t>(result.completed).putSpan(std::span<DataType const>{ result.values }).put(status).putString(message);
+            return;
+        }
+        }
+        throw RemoteTargetException(std::format("Unknown remote op {}!", static_cast<unsigned>(op)));
+    }
+
+    // Block operations divide the data into `rows` equal rows.
+    static void checkRows(uint64_t rows, size_t count)
+    {
+        if (rows == 0 || count % rows != 0)
+            throw RemoteTargetException("Remote block size isn't a multiple of its rows!");
+    }
+    static BasicPoller getPoller(MessageReader& r)
+    {
+        auto const initial_delay = r.getDuration();
+        auto const wait_delay = r.getDuration();
+        auto const timeout = r.getDuration();
+        return BasicPoller(initial_delay, wait_delay, timeout);
+    }
+    static SequenceType getSequence(MessageReader& r)
+    {
+        SequenceType sequence;
+        uint64_t const count = r.get<uint64_t>();
+        for (uint64_t i = 0 ; i < count ; i++) {
+            typename SequenceType::Op op{ .code = r.get<typename SequenceType::OpCode>() };
+            op.addr = r.get<AddressType>();
+            op.data = r.get<DataType>();
+            op.mask = r.get<DataType>();
+            op.delay = r.getDuration();
+            op.wait_delay = r.getDuration();
+            op.timeout = r.getDuration();
+            op.msg = r.getString();
+            sequence.add(std::move(op));
+        }
+        return sequence;
+    }
+
+    TargetType& target;
+    // Scratch buffers, kept to avoid allocating per request
+    std::vector<AddressType> addresses;
+    std::vector<DataType> data;
+};
+
+// Anything a server transport can pass requests to, such as a RegisterServer or a RegisterServerMux.
+template <typename ServerType>
+concept CRegisterServer = requires(ServerType& server, std::span<std::byte const> request, std::vector<std::byte>& response, std::span<std::byte const>& response_payload)
+{
+    server.handle(request, response);
+    server.handle(request, response, response_payload);
+};
+
+// An IRegisterTarget whose operations are executed by a RegisterServer at the other end of an IRemoteTransport.
+// Compound operations and sequences are executed by the server, so each costs one round trip.
+template <ValidAddressOrDataType AddressType_, ValidAddressOrDataType DataType_>
+class RemoteRegisterTarget : public IRegisterTarget<AddressType_, DataType_>
+{
+public:
+    using AddressType = AddressType_;
+    using DataType = DataType_;
+    using SequenceType = RegisterSequence<AddressType, DataType>;
+
+    RemoteRegisterTarget(std::string_view name, OwnedOrViewedObject<IRemoteTransport> transport)
+        : IRegisterTarget<AddressType, DataType>(name)
+        , transport(std::move(transport))
+    {}
+    virtual std::string_view getDomain() const override { return "RemoteRegisterTarget"; }
+
+    virtual void write(AddressType addr, DataType data) override
+    {
+        std::lock_guard lock(this->mutex);
+        this->call(this->begin(RemoteOp::Write).put(addr).put(data));
+    }
+    [[nodiscard]] virtual DataType read(AddressType addr) override
+    {
+        std::lock_guard lock(this->mutex);
+        return this->call(this->begin(RemoteOp::Read).put(addr)).template get<DataType>();
+    }
+    virtual void readModifyWrite(AddressType addr, DataType new_data, DataType mask) override
+    {
+        std::lock_guard lock(this->mutex);
+        this->call(this->begin(RemoteOp::ReadModifyWrite).put(addr).put(new_data).put(mask));
+    }
+    [[nodiscard]] virtual DataType writeReadBack(AddressType addr, DataType data) override
+    {
+        std::lock_guard lock(this->mutex);
+        return this->call(this->begin(RemoteOp::WriteReadBack).put(addr).put(data)).template get<DataType>();
+    }
+    virtual bool pollRead(AddressType addr, DataType expected, DataType mask, BasicPoller const& poller, DataType& out_data) override
+    {
+        std::lock_guard lock(this->mutex);
+        MessageWriter w = this->begin(RemoteOp::PollRead);
+        w.put(addr).put(expected).put(mask);
+        w.putDuration(poller.getInitialDelay()).putDuration(poller.getWaitDelay()).putDuration(poller.getTimeout());
+        MessageReader r = this->call(w);
+        bool const success = r.get<bool>();
+        out_data = r.get<DataType>();
+        return success;
+    }
+
+    virtual void seqWrite(AddressType start_addr, std::span<DataType const> data, size_t increment = sizeof(DataType)) override
+    {
+        std::lock_guard lock(this->mutex);
+        this->call(this->begin(RemoteOp::SeqWrite).put(start_addr).template put<uint64_t>(increment).template put<uint64_t>(data.size()), { std::as_bytes(data) });
+    }
+    virtual void seqRead(AddressType start_addr, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override
+    {
+        std::lock_guard lock(this->mutex);
+        this->callInto(this->begin(RemoteOp::SeqRead).put(start_addr).template put<uint64_t>(increment).template put<uint64_t>(out_data.size()), out_data);
+    }
+    virtual void seqFill(AddressType start_addr, DataType value, size_t count, size_t increment = sizeof(DataType)) override
+    {
+        std::lock_guard lock(this->mutex);
+        this->call(this->begin(RemoteOp::SeqFill).put(start_addr).put(value).template put<uint64_t>(count).template put<uint64_t>(increment));
+    }
+    virtual void seqReadModifyWrite(AddressType start_addr, DataType new_data, DataType mask, size_t count, size_t increment = sizeof(DataType)) override
+    {
+        std::lock_guard lock(this->mutex);
+        this->call(this->begin(RemoteOp::SeqReadModifyWrite).put(start_addr).put(new_data).put(mask).template put<uint64_t>(count).template put<uint64_t>(increment));
+    }
+    virtual void blockWrite(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType const> data, size_t increment = sizeof(DataType)) override
+    {
+        std::lock_guard lock(this->mutex);
+        this->call(this->begin(RemoteOp::BlockWrite).put(start_addr).template put<uint64_t>(rows).template put<uint64_t>(row_stride).template put<uint64_t>(increment).template put<uint64_t>(data.size()), { std::as_bytes(data) });
+    }
+    virtual void blockRead(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override
+    {
+        std::lock_guard lock(this->mutex);
+        this->callInto(this->begin(RemoteOp::BlockRead).put(start_addr).template put<uint64_t>(rows).template put<uint64_t>(row_stride).template put<uint64_t>(increment).template put<uint64_t>(out_data.size()), out_data);
+    }
+
+    virtual void fifoWrite(AddressType fifo_addr, std::span<DataType const> data) override
+    {
+        std::lock_guard lock(this->mutex);
+        this->call(this->begin(RemoteOp::FifoWrite).put(fifo_addr).template put<uint64_t>(data.size()), { std::as_bytes(data) });
+    }
+    virtual void fifoRead(AddressType fifo_addr, std::span<DataType> out_data) override
+    {
+        std::lock_guard lock(this->mutex);
+        this->callInto(this->begin(RemoteOp::FifoRead).put(fifo_addr).template put<uint64_t>(out_data.size()), out_data);
+    }
+
+    virtual void compWrite(std::span<std::pair<AddressType, DataType> const> addr_data) override
+    {
+        std::lock_guard lock(this->mutex);
+        this->addresses.clear();
+        this->data.clear();
+        for (auto const& ad : addr_data) {
+            this->addresses.push_back(ad.first);
+            this->data.push_back(ad.second);
+        }
+        this->callCompWrite(this->addresses, this->data);
+    }
+    virtual void compWrite(std::span<AddressType const> const addresses, std::span<DataType const> data) override
+    {
+        assert(addresses.size() == data.size());
+        std::lock_guard lock(this->mutex);
+        this->callCompWrite(addresses, data);
+    }
+    virtual void compRead(std::span<AddressType const> const addresses, std::span<DataType> out_data) override
+    {
+        assert(addresses.size() == out_data.size());
+        std::lock_guard lock(this->mutex);
+        this->callInto(this->begin(RemoteOp::CompRead).template put<uint64_t>(addresses.size()), out_data, { std::as_bytes(addresses) });
+    }
+
+    virtual SequenceResult<DataType> executeSequence(SequenceType const& sequence) override
+    {
+        using OpCode = typename SequenceType::OpCode;
+        std::lock_guard lock(this->mutex);
+        MessageWriter w = this->begin(RemoteOp::ExecuteSequence);
+        w.put<uint64_t>(sequence.size());
+        for (auto const& op : sequence.getOps()) {
+            w.put(op.code).put(op.addr).put(op.data).put(op.mask);
+            w.putDuration(op.delay).putDuration(op.wait_delay).putDuration(op.timeout);
+            w.putString(op.msg);
+        }
+        MessageReader r = this->call(w);
+        SequenceResult<DataType> result;
+        result.completed = r.get<uint64_t>();
+        result.values = r.getVector<DataType>();
+        auto const status = r.get<RemoteStatus>();
+        std::string const message = r.getString();
+        if (status == RemoteStatus::Ok)
+            return result;
+        if (result.completed >= sequence.size() || result.values.size() != sequence.size())
+            throw RemoteTargetException("Malformed ExecuteSequence response!");
+        // Verify failures are rebuilt from the failed operation so they have the same type as a local failure
+        auto const& op = sequence.getOps()[result.completed];
+        DataType const expected_val = op.data & op.mask;
+        DataType const actual = result.values[result.completed];
+        if (status == RemoteStatus::VerifyFailure && op.code == OpCode::WriteVerify)
+            result.error = std::make_exception_ptr(WriteVerifyFailureException(expected_val, op.mask, actual));
+        else if (status == RemoteStatus::VerifyFailure && op.code == OpCode::ReadVerify)
+            result.error = std::make_exception_ptr(ReadVerifyFailureException(expected_val, op.mask, actual));
+        else if (status == RemoteStatus::VerifyFailure && op.code == OpCode::PollRead)
+            result.error = std::make_exception_ptr(PollReadTimeoutException(expected_val, op.mask, actual));
+        else
+            result.error = std::make_exception_ptr(RemoteTargetException(message));
+        return result;
+    }
+
+private:
+    MessageWriter begin(RemoteOp op)
+    {
+        MessageWriter w(this->request);
+        w.put(op);
+        return w;
+    }
+    // Sends the request, followed by `request_payload` which is sent from the caller's buffers rather than copied into the request.
+    // Returns a reader positioned after the status, or throws the server's error.
+    MessageReader call(MessageWriter const&, std::initializer_list<std::span<std::byte const>> request_payload = {}, std::span<std::byte> response_payload = {})
+    {
+        this->parts.assign(1, this->request);
+        this->parts.insert(this->parts.end(), request_payload.begin(), request_payload.end());
+        this->scattered = this->transport->transact(this->parts, this->response, response_payload);
+        MessageReader r(this->response);
+        if (r.get<RemoteStatus>() != RemoteStatus::Ok)
+            throw RemoteTargetException(r.getString());
+        return r;
+    }
+    // As above, for responses ending in `out_data`, which the transport may receive into directly.
+    template <typename T>
+    void callInto(MessageWriter const& w, std::span<T> out_data, std::initializer_list<std::span<std::byte const>> request_payload = {})
+    {
+        MessageReader r = this->call(w, request_payload, std::as_writable_bytes(out_data));
+        if (!this->scattered)
+            r.getSpan(out_data);
+        else if (r.get<uint64_t>() != out_data.size())
+            throw RemoteTargetException("Remote message span size mismatch!");
+    }
+    void callCompWrite(std::span<AddressType const> addresses, std::span<DataType const> data)
+    {
+        uint64_t const data_count = data.size();
+        this->call(this->begin(RemoteOp::CompWrite).template put<uint64_t>(addresses.size()),
+                   { std::as_bytes(addresses), std::as_bytes(std::span{ &data_count, 1 }), std::as_bytes(data) });
+    }
+
+    OwnedOrViewedObject<IRemoteTransport> transport;
+    std::mutex mutex;
+    std::vector<std::byte> request;
+    std::vector<std::byte> response;
+    std::vector<std::span<std::byte const>> parts;
+    bool scattered = false;
+    std::vector<AddressType> addresses;
+    std::vector<DataType> data;
+};
+
+}
@@ -0,0 +1,269 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include "RTF_Remote.h"
+#include "RTF_Executor.h"
+#include <array>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+namespace RTF {
+
+using RemoteTargetId = uint32_t;
+
+struct RemoteSessionOptions
+{
+    std::chrono::microseconds flush_interval = {};  // how long the first request of a batch waits for others to join it
+    size_t flush_bytes = 64 * 1024;                 // a batch is sent as soon as it grows to this size
+};
+
+// Multiplexes the requests of many RemoteRegisterTargets over one transport.
+// Requests made while a batch is being collected, or while the previous batch is in flight, are sent together as one message.
+// A batch is a count followed by that many (target id, length-prefixed request) entries,
+// and its response is a count followed by that many length-prefixed responses, in the same order.
+class RemoteSession
+{
+public:
+    RemoteSession(OwnedOrViewedObject<IRemoteTransport> transport, RemoteSessionOptions const& options = {})
+        : transport(std::move(transport))
+        , options(options)
+    {}
+    RemoteSession(RemoteSession const&) = delete;
+    RemoteSession& operator=(RemoteSession const&) = delete;
+
+    // Returns a transport for a RemoteRegisterTarget that addresses `target_id` on the server's RegisterServerMux.
+    // The channel refers to the session, which must outlive it.
+    [[nodiscard]] std::unique_ptr<IRemoteTransport> openChannel(RemoteTargetId target_id)
+    {
+        return std::make_unique<Channel>(*this, target_id);
+    }
+
+    [[nodiscard]] uint64_t getBatches() const { std::lock_guard lock(this->mutex); return this->batches; }
+    [[nodiscard]] uint64_t getRequests() const { std::lock_guard lock(this->mutex); return this->requests; }
+
+private:
+    class Channel : public IRemoteTransport
+    {
+    public:
+        Channel(RemoteSession& session, RemoteTargetId target_id) : session(session), target_id(target_id) {}
+        virtual void transact(std::span<std::byte const> request, std::vector<std::byte>& response) override
+        {
+            this->session.transact(this->target_id, std::span{ &request, 1 }, response);
+        }
+        // The parts are appended straight to the batch.  Responses are copied out of the batch response, so they are never scattered.
+        virtual bool transact(std::span<std::span<std::byte const> const> request_parts, std::vector<std::byte>& response, std::span<std::byte>) override
+        {
+            this->session.transact(this->target_id, request_parts, response);
+            return false;
+        }
+    private:
+        RemoteSession& session;
+        RemoteTargetId const target_id;
+    };
+
+    struct Pending
+    {
+        std::vector<std::byte>& response;
+        bool done = false;
+        std::exception_ptr error = {};
+    };
+    struct Batch
+    {
+        std::vector<std::byte> request;
+        std::vector<Pending*> pending;
+    };
+
+    void transact(RemoteTargetId target_id, std::span<std::span<std::byte const> const> request_parts, std::vector<std::byte>& response)
+    {
+        Pending pending{ response };
+        std::unique_lock lock(this->mutex);
+        // The first request of a batch is its leader, which sends the batch and hands out the responses.
+        bool const leader = this->collecting.pending.empty();
+        uint64_t length = 0;
+        for (auto const part : request_parts) {
+            length += part.size();
+        }
+        MessageWriter w(this->collecting.request, true);
+        w.put(target_id).put(length);
+        for (auto const part : request_parts) {
+            w.putBytes(part);
+        }
+        this->collecting.pending.push_back(&pending);
+        this->requests++;
+        if (this->collecting.request.size() >= this->options.flush_bytes)
+            this->collecting_cv.notify_all();
+
+        if (!leader) {
+            this->done_cv.wait(lock, [&] { return pending.done; });
+            if (pending.error)
+                std::rethrow_exception(pending.error);
+            return;
+        }
+
+        if (this->options.flush_interval.count() > 0)
+            this->collecting_cv.wait_for(lock, this->options.flush_interval, [this] { return this->collecting.request.size() >= this->options.flush_bytes; });
+        lock.unlock();
+        // Requests keep joining the batch while the previous batch holds the transport.
+        std::unique_lock transport_lock(this->transport_mutex);
+        lock.lock();
+        Batch batch;
+        std::swap(batch, this->collecting);
+        this->batches++;
+        lock.unlock();
+
+        std::exception_ptr error;
+        try {
+            this->send(batch);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        transport_lock.unlock();
+
+        lock.lock();
+        for (Pending* const p : batch.pending) {
+            p->error = error;
+            p->done = true;
+        }
+        lock.unlock();
+        this->done_cv.notify_all();
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    // Called with only the transport lock held.
+    void send(Batch& batch)
+    {
+        uint64_t const count = batch.pending.size();
+        std::array<std::span<std::byte const>, 2> const parts{ std::as_bytes(std::span{ &count, 1 }), std::span<std::byte const>{ batch.request } };
+        this->transport->transact(parts, this->batch_response, {});
+        MessageReader r(this->batch_response);
+        if (r.get<uint64_t>() != count)
+            throw RemoteTargetException("Remote session batch response doesn't match its request!");
+        for (Pending* const p : batch.pending) {
+            auto const bytes = r.getBytes();
+            p->response.assign(bytes.begin(), bytes.end());
+        }
+    }
+
+    OwnedOrViewedObject<IRemoteTransport> transport;
+    RemoteSessionOptions const options;
+    mutable std::mutex mutex;
+    std::mutex transport_mutex;
+    std::condition_variable collecting_cv;
+    std::condition_variable done_cv;
+    Batch collecting;
+    std::vector<std::byte> batch_response;
+    uint64_t batches = 0;
+    uint64_t requests = 0;
+};
+
+// The server side of a RemoteSession: handles each request of a batch with the RegisterServer registered for its target id.
+// The response to a batch is sent once every request in it has been handled, so one long request (e.g. a pollRead()) delays the
+// responses to the whole batch, and to every batch behind it on the transport.  Given an Executor, requests to different targets
+// are handled concurrently, so at least they don't also wait for each other to run.
+class RegisterServerMux
+{
+public:
+    using HandlerType = std::function<void(std::span<std::byte const> request, std::vector<std::byte>& response)>;
+
+    RegisterServerMux() = default;
+    // Handles the requests of a batch to different targets concurrently on `executor`; requests to the same target stay in order.
+    // The handlers of different targets must then be safe to call concurrently.
+    explicit RegisterServerMux(Executor& executor) : executor(&executor) {}
+
+    void addTarget(RemoteTargetId target_id, HandlerType handler)
+    {
+        this->targets[target_id] = std::move(handler);
+    }
+    template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+    void addTarget(RemoteTargetId target_id, RegisterServer<AddressType, DataType>& server)
+    {
+        this->addTarget(target_id, [&server](std::span<std::byte const> req, std::vector<std::byte>& resp) { server.handle(req, resp); });
+    }
+
+    // A malformed batch gets an empty response, which fails every request in it.
+    void handle(std::span<std::byte const> request, std::vector<std::byte>& response)
+    {
+        MessageWriter w(response);
+        try {
+            MessageReader r(request);
+            uint64_t const count = r.get<uint64_t>();
+            this->requests.clear();
+            for (uint64_t i = 0 ; i < count ; i++) {
+                auto const target_id = r.get<RemoteTargetId>();
+                this->requests.push_back({ target_id, r.getBytes() });
+            }
+            if (this->responses.size() < this->requests.size())
+                this->responses.resize(this->requests.size());
+            if (this->executor)
+                this->handleConcurrently();
+            else
+                this->handleInOrder();
+            w.put(count);
+            for (size_t i = 0 ; i < this->requests.size() ; i++) {
+                w.putSpan(std::span<std::byte const>{ this->responses[i] });
+            }
+        }
+        catch (std::exception const&) {
+            MessageWriter(response).put<uint64_t>(0);
+        }
+    }
+    void handle(std::span<std::byte const> request, std::vector<std::byte>& response, std::span<std::byte const>& response_payload)
+    {
+        response_payload = {};
+        this->handle(request, response);
+    }
+
+private:
+    struct Request
+    {
+        RemoteTargetId target_id;
+        std::span<std::byte const> request;
+    };
+
+    void handleOne(size_t index)
+    {
+        Request const& request = this->requests[index];
+        auto const it = this->targets.find(request.target_id);
+        if (it != this->targets.end())
+            it->second(request.request, this->responses[index]);
+        else
+            MessageWriter(this->responses[index]).put(RemoteStatus::Error).putString(std::format("Unknown remote target {}!", request.target_id));
+    }
+    void handleInOrder()
+    {
+        for (size_t i = 0 ; i < this->requests.size() ; i++) {
+            this->handleOne(i);
+        }
+    }
+    // One task per target, which handles that target's requests in batch order.
+    void handleConcurrently()
+    {
+        std::unordered_map<RemoteTargetId, std::vector<size_t>> by_target;
+        for (size_t i = 0 ; i < this->requests.size() ; i++) {
+            by_target[this->requests[i].target_id].push_back(i);
+        }
+        if (by_target.size() <= 1)
+            return this->handleInOrder();
+        TaskGroup group(*this->executor);
+        for (auto const& [target_id, indices] : by_target) {
+            group.post([this, &indices] {
+                for (size_t const i : indices) {
+                    this->handleOne(i);
+                }
+            });
+        }
+        group.wait();
+    }
+
+    Executor* executor = nullptr;
+    std::unordered_map<RemoteTargetId, HandlerType> targets;
+    std::vector<Request> requests;
+    std::vector<std::vector<std::byte>> responses;
+};
+
+}
@@ -0,0 +1,422 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include "RTF_Remote.h"
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#ifndef RTF_SHM_SPIN_COUNT
+#define RTF_SHM_SPIN_COUNT 4000
+#endif
+
+namespace RTF {
+
+// Control words of one single-producer single-consumer byte ring.
+// `head` and `tail` count bytes consumed and produced (wrapping), and are also the futex words the reader and writer sleep on.
+struct ShmRingControl
+{
+    alignas(64) std::atomic<uint32_t> head;
+    std::atomic<uint32_t> writer_waiting;
+    alignas(64) std::atomic<uint32_t> tail;
+    std::atomic<uint32_t> reader_waiting;
+};
+
+struct ShmSegmentHeader
+{
+    std::atomic<uint32_t> magic;    // set last by the creator, once the rest is initialized
+    uint32_t ring_capacity;
+    int32_t server_pid;             // the creating process, so a client can tell it has died
+    ShmRingControl request;
+    ShmRingControl response;
+};
+
+// A POSIX shared memory segment holding a request ring and a response ring.
+class ShmSegment
+{
+public:
+    static constexpr uint32_t segment_magic = 0x52544631;
+
+    // Creates the segment `name` (e.g. "/my_device") with two rings of `ring_capacity` bytes; it is unlinked again on destruction.
+    ShmSegment(std::string_view name, uint32_t ring_capacity)
+        : name(name)
+        , owner(true)
+    {
+        assert(std::has_single_bit(ring_capacity));
+        int const fd = ::shm_open(this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+            throwError("shm_open");
+        this->size = sizeof(ShmSegmentHeader) + (2 * size_t{ ring_capacity });
+        if (::ftruncate(fd, static_cast<off_t>(this->size)) != 0) {
+            int const err = errno;
+            ::close(fd);
+            ::shm_unlink(this->name.c_str());
+            throwError("ftruncate", err);
+        }
+        this->map(fd);
+        ShmSegmentHeader* const header = new (this->base) ShmSegmentHeader{};
+        header->ring_capacity = ring_capacity;
+        header->server_pid = static_cast<int32_t>(::getpid());
+        header->magic.store(segment_magic, std::memory_order_release);
+    }
+    // Opens a segment created by another process.
+    explicit ShmSegment(std::string_view name)
+        : name(name)
+        , owner(false)
+    {
+        int const fd = ::shm_open(this->name.c_str(), O_RDWR, 0);
+        if (fd < 0)
+            throwError("shm_open");
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ShmSegmentHeader)) {
+            ::close(fd);
+            throw RemoteTargetException(std::format("Shared memory segment {} isn't ready!", this->name));
+        }
+        this->size = static_cast<size_t>(st.st_size);
+        this->map(fd);
+        if (this->header().magic.load(std::memory_order_acquire) != segment_magic
+            || this->size != sizeof(ShmSegmentHeader) + (2 * size_t{ this->header().ring_capacity })) {
+            ::munmap(this->base, this->size);
+            throw RemoteTargetException(std::format("Shared memory segment {} isn't a register transport!", this->name));
+        }
+    }
+    ~ShmSegment()
+    {
+        ::munmap(this->base, this->size);
+        if (this->owner)
+            ::shm_unlink(this->name.c_str());
+    }
+    ShmSegment(ShmSegment const&) = delete;
+    ShmSegment& operator=(ShmSegment const&) = delete;
+
+    [[nodiscard]] ShmSegmentHeader& header() const { return *static_cast<ShmSegmentHeader*>(this->base); }
+    [[nodiscard]] std::byte* requestData() const { return static_cast<std::byte*>(this->base) + sizeof(ShmSegmentHeader); }
+    [[nodiscard]] std::byte* responseData() const { return this->requestData() + this->header().ring_capacity; }
+
+private:
+    void map(int fd)
+    {
+        this->base = ::mmap(nullptr, this->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int const err = errno;
+        ::close(fd);
+        if (this->base == MAP_FAILED) {
+            if (this->owner)
+                ::shm_unlink(this->name.c_str());
+            throwError("mmap", err);
+        }
+    }
+    [[noreturn]] void throwError(char const* what, int err = errno) const
+    {
+        throw RemoteTargetException(std::format("{}({}) failed: {}", what, this->name, std::strerror(err)));
+    }
+
+    std::string name;
+    bool owner;
+    size_t size = 0;
+    void* base = nullptr;
+};
+
+// One side of a ShmRingControl.  Waiters spin for a while, then sleep on a futex; the other side only makes the wake syscall when a waiter is asleep.
+class ShmByteRing
+{
+public:
+    using Deadline = std::chrono::steady_clock::time_point;
+    using Duration = std::chrono::steady_clock::duration;
+
+    ShmByteRing(ShmRingControl& control, std::byte* data, uint32_t capacity)
+        : control(control)
+        , data(data)
+        , capacity(capacity)
+    {}
+
+    // Each returns false if the other side made no progress for `stall_timeout`, possibly after transferring part of the bytes.
+    bool write(std::span<std::byte const> bytes, Duration stall_timeout)
+    {
+        while (!bytes.empty()) {
+            uint32_t const tail = this->control.tail.load(std::memory_order_relaxed);
+            uint32_t const head = this->control.head.load(std::memory_order_acquire);
+            uint32_t const space = this->capacity - (tail - head);
+            if (space == 0) {
+                if (!wait(this->control.head, head, this->control.writer_waiting, std::chrono::steady_clock::now() + stall_timeout))
+                    return false;
+                continue;
+            }
+            uint32_t const n = static_cast<uint32_t>(std::min<size_t>(space, bytes.size()));
+            uint32_t const offset = tail & (this->capacity - 1);
+            uint32_t const first = std::min(n, this->capacity - offset);
+            std::memcpy(this->data + offset, bytes.data(), first);
+            std::memcpy(this->data, bytes.data() + first, n - first);
+            this->control.tail.store(tail + n, std::memory_order_seq_cst);
+            wake(this->control.tail, this->control.reader_waiting);
+            bytes = bytes.subspan(n);
+        }
+        return true;
+    }
+    bool read(std::span<std::byte> out, Duration stall_timeout)
+    {
+        while (!out.empty()) {
+            uint32_t const head = this->control.head.load(std::memory_order_relaxed);
+            uint32_t const tail = this->control.tail.load(std::memory_order_acquire);
+            if (tail == head) {
+                if (!wait(this->control.tail, tail, this->control.reader_waiting, std::chrono::steady_clock::now() + stall_timeout))
+                    return false;
+                continue;
+            }
+            uint32_t const n = static_cast<uint32_t>(std::min<size_t>(tail - head, out.size()));
+            uint32_t const offset = head & (this->capacity - 1);
+            uint32_t const first = std::min(n, this->capacity - offset);
+            std::memcpy(out.data(), this->data + offset, first);
+            std::memcpy(out.data() + first, this->data, n - first);
+            this->control.head.store(head + n, std::memory_order_seq_cst);
+            wake(this->control.head, this->control.writer_waiting);
+            out = out.subspan(n);
+        }
+        return true;
+    }
+    bool waitReadable(Deadline deadline)
+    {
+        uint32_t const head = this->control.head.load(std::memory_order_relaxed);
+        return wait(this->control.tail, head, this->control.reader_waiting, deadline);
+    }
+
+    // Messages are a 64-bit length followed by that many bytes, and may be larger than the ring but not than max_message_bytes.
+    bool writeMessage(std::span<std::byte const> message, Duration stall_timeout)
+    {
+        uint64_t const length = message.size();
+        return this->write(std::as_bytes(std::span{ &length, 1 }), stall_timeout) && this->write(message, stall_timeout);
+    }
+    // Writes the concatenation of `parts` as one message, without joining them first.
+    bool writeMessage(std::span<std::span<std::byte const> const> parts, Duration stall_timeout)
+    {
+        uint64_t length = 0;
+        for (auto const part : parts) {
+            length += part.size();
+        }
+        if (!this->write(std::as_bytes(std::span{ &length, 1 }), stall_timeout))
+            return false;
+        for (auto const part : parts) {
+            if (!this->write(part, stall_timeout))
+                return false;
+        }
+        return true;
+    }
+    bool readMessage(std::vector<std::byte>& message, Duration stall_timeout)
+    {
+        uint64_t length = 0;
+        if (!this->read(std::as_writable_bytes(std::span{ &length, 1 }), stall_timeout))
+            return false;
+        if (length > max_message_bytes)
+            throw RemoteTargetException("Remote message too large!");
+        message.resize(length);
+        return this->read(message, stall_timeout);
+    }
+
+private:
+    // Waits until `word` no longer holds `seen`.
+    static bool wait(std::atomic<uint32_t>& word, uint32_t seen, std::atomic<uint32_t>& waiting, Deadline deadline)
+    {
+        // Spinning only helps if the other side can run at the same time.
+        static int const spin_count = (std::thread::hardware_concurrency() > 1) ? RTF_SHM_SPIN_COUNT : 0;
+        for (int i = 0 ; i < spin_count ; i++) {
+            if (word.load(std::memory_order_acquire) != seen)
+                return true;
+            cpuRelax();
+        }
+        for (;;) {
+            // Pairs with the seq_cst store and load in wake(), so either the writer sees the flag or we see its update.
+            waiting.store(1, std::memory_order_seq_cst);
+            if (word.load(std::memory_order_seq_cst) != seen) {
+                waiting.store(0, std::memory_order_relaxed);
+                return true;
+            }
+            auto const now = std::chrono::steady_clock::now();
+            if (now >= deadline) {
+                waiting.store(0, std::memory_order_relaxed);
+                return false;
+            }
+            sleep(word, seen, std::min<std::chrono::steady_clock::duration>(deadline - now, std::chrono::seconds(1)));
+            waiting.store(0, std::memory_order_relaxed);
+            if (word.load(std::memory_order_acquire) != seen)
+                return true;
+        }
+    }
+    static void wake(std::atomic<uint32_t>& word, std::atomic<uint32_t>& waiting)
+    {
+        if (waiting.load(std::memory_order_seq_cst) == 0)
+            return;
+        #if defined(__linux__)
+        ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+        #else
+        (void)word;
+        #endif
+    }
+    static void sleep([[maybe_unused]] std::atomic<uint32_t>& word, [[maybe_unused]] uint32_t seen, std::chrono::steady_clock::duration timeout)
+    {
+        #if defined(__linux__)
+        auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+        timespec const ts{ static_cast<time_t>(ns / 1'000'000'000), static_cast<long>(ns % 1'000'000'000) };
+        ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, seen, &ts, nullptr, 0);
+        #else
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(timeout, std::chrono::microseconds(50)));
+        #endif
+    }
+    static void cpuRelax()
+    {
+        #if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+        #elif defined(__aarch64__)
+        asm volatile("yield");
+        #endif
+    }
+
+    ShmRingControl& control;
+    std::byte* data;
+    uint32_t capacity;
+};
+
+// The client end of a shared memory transport, for a RemoteRegisterTarget on the same host as the RegisterServer.
+// Each segment connects one client to one server.
+class ShmClientTransport : public IRemoteTransport
+{
+public:
+    // `timeout` bounds how long either side may stall part-way through a message, not how long the server may take to execute a request.
+    explicit ShmClientTransport(std::string_view name, std::chrono::microseconds timeout = std::chrono::seconds(1))
+        : segment(name)
+        , request(segment.header().request, segment.requestData(), segment.header().ring_capacity)
+        , response(segment.header().response, segment.responseData(), segment.header().ring_capacity)
+        , timeout(timeout)
+    {}
+
+    virtual void transact(std::span<std::byte const> request_message, std::vector<std::byte>& response_message) override
+    {
+        this->transact(std::span{ &request_message, 1 }, response_message, {});
+    }
+    // Request parts are copied straight into the ring.
+    virtual bool transact(std::span<std::span<std::byte const> const> request_parts, std::vector<std::byte>& response_message, std::span<std::byte>) override
+    {
+        std::lock_guard lock(this->mutex);
+        if (this->broken)
+            throw RemoteTargetException("Shared memory transport is broken by an earlier error!");
+        // Failing part-way through a message leaves the rings out of step with the server, so the transport is broken until the whole transaction completes.
+        this->broken = true;
+        if (!this->request.writeMessage(request_parts, this->timeout))
+            throw RemoteTargetException("Shared memory transport timed out!");
+        // The server takes as long as the request needs (e.g. a long pollRead()), so wait for it to start responding without a deadline,
+        // as long as it is still there.
+        while (!this->response.waitReadable(std::chrono::steady_clock::now() + std::chrono::milliseconds(100))) {
+            if (this->segment.header().magic.load(std::memory_order_acquire) != ShmSegment::segment_magic)
+                throw RemoteTargetException("Shared memory transport server has shut down!");
+            // A server process that crashed never clears the magic.
+            if (::kill(this->segment.header().server_pid, 0) != 0 && errno == ESRCH)
+                throw RemoteTargetException("Shared memory transport server process has exited!");
+        }
+        if (!this->response.readMessage(response_message, this->timeout))
+            throw RemoteTargetException("Shared memory transport timed out!");
+        this->broken = false;
+        return false;
+    }
+
+private:
+    ShmSegment segment;
+    ShmByteRing request;
+    ShmByteRing response;
+    std::chrono::microseconds timeout;
+    std::mutex mutex;
+    bool broken = false;
+};
+
+// The server end of a shared memory transport.  Creates the segment, which the client then opens by name.
+class ShmServerTransport
+{
+public:
+    using HandlerType = std::function<void(std::span<std::byte const> request, std::vector<std::byte>& response)>;
+
+    ShmServerTransport(std::string_view name, uint32_t ring_capacity = 1u << 20, std::chrono::microseconds timeout = std::chrono::seconds(1))
+        : segment(name, ring_capacity)
+        , request(segment.header().request, segment.requestData(), ring_capacity)
+        , response(segment.header().response, segment.responseData(), ring_capacity)
+        , timeout(timeout)
+    {}
+    ~ShmServerTransport()
+    {
+        this->stop();
+        // Tells a client still waiting for a response that none is coming.
+        this->segment.header().magic.store(0, std::memory_order_release);
+    }
+    ShmServerTransport(ShmServerTransport const&) = delete;
+    ShmServerTransport& operator=(ShmServerTransport const&) = delete;
+
+    // Waits up to `wait` for a request, then handles it.  Returns false if no request arrived.
+    bool serveOne(HandlerType const& handler, std::chrono::microseconds wait)
+    {
+        if (!this->request.waitReadable(std::chrono::steady_clock::now() + wait))
+            return false;
+        if (!this->request.readMessage(this->request_message, this->timeout))
+            throw RemoteTargetException("Shared memory transport timed out reading a request!");
+        handler(this->request_message, this->response_message);
+        if (!this->response.writeMessage(this->response_message, this->timeout))
+            throw RemoteTargetException("Shared memory transport timed out writing a response!");
+        return true;
+    }
+    template <CRegisterServer ServerType>
+    bool serveOne(ServerType& server, std::chrono::microseconds wait)
+    {
+        return this->serveOne([&server](std::span<std::byte const> req, std::vector<std::byte>& resp) { server.handle(req, resp); }, wait);
+    }
+
+    // Serves requests on a background thread until stop(), or until the client breaks the protocol or the handler throws.
+    // In the latter cases the segment is marked as shut down, since the rings are out of step, so the client fails instead of waiting forever.
+    void start(HandlerType handler)
+    {
+        this->stop();
+        this->running = true;
+        this->thread = std::thread([this, handler = std::move(handler)] {
+            try {
+                while (this->running.load(std::memory_order_relaxed)) {
+                    this->serveOne(handler, std::chrono::milliseconds(100));
+                }
+            }
+            catch (...) {
+                this->segment.header().magic.store(0, std::memory_order_release);
+                this->running = false;
+            }
+        });
+    }
+    template <CRegisterServer ServerType>
+    void start(ServerType& server)
+    {
+        this->start([&server](std::span<std::byte const> req, std::vector<std::byte>& resp) { server.handle(req, resp); });
+    }
+    void stop()
+    {
+        this->running = false;
+        if (this->thread.joinable())
+            this->thread.join();
+    }
+    [[nodiscard]] bool isRunning() const { return this->running; }
+
+private:
+    ShmSegment segment;
+    ShmByteRing request;
+    ShmByteRing response;
+    std::chrono::microseconds timeout;
+    std::vector<std::byte> request_message;
+    std::vector<std::byte> response_message;
+    std::atomic<bool> running = false;
+    std::thread thread;
+};
+
+}
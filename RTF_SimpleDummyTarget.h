@@ -27,6 +27,22 @@ public:
         LOG_NOISE(this, "read(0x{:0{}x}) -> 0x{:0{}x}", addr, sizeof(AddressType) * 2, rv, sizeof(DataType) * 2);
         return rv;
     }
+    virtual void seqFill(AddressType start_addr, DataType value, size_t count, size_t increment = sizeof(DataType)) override
+    {
+        LOG_NOISE(this, "seqFill(0x{:0{}x}, 0x{:0{}x}, {}, {})", start_addr, sizeof(AddressType) * 2, value, sizeof(DataType) * 2, count, increment);
+        this->regs.reserve(this->regs.size() + count);
+        for (size_t i = 0 ; i < count ; i++) {
+            this->regs[static_cast<AddressType>(start_addr + (increment * i))] = value;
+        }
+    }
+    virtual void seqReadModifyWrite(AddressType start_addr, DataType new_data, DataType mask, size_t count, size_t increment = sizeof(DataType)) override
+    {
+        LOG_NOISE(this, "seqReadModifyWrite(0x{:0{}x}, 0x{:0{}x}, 0x{:0{}x}, {}, {})", start_addr, sizeof(AddressType) * 2, new_data, sizeof(DataType) * 2, mask, sizeof(DataType) * 2, count, increment);
+        for (size_t i = 0 ; i < count ; i++) {
+            DataType& v = this->regs[static_cast<AddressType>(start_addr + (increment * i))];
+            v = static_cast<DataType>((v & ~mask) | (new_data & mask));
+        }
+    }
 protected:
     std::unordered_map<AddressType, DataType> regs;
 };
@@ -0,0 +1,284 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include "RTF_Remote.h"
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <mutex>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/errqueue.h>
+#endif
+
+namespace RTF {
+
+// A connected stream socket carrying frames of a header followed by a bulk payload.
+// Frames are sent with sendmsg() straight from the caller's buffers, and a payload of the expected size is received straight into the caller's buffer.
+class SocketStream
+{
+public:
+    // Takes ownership of `fd`.  Payloads of at least `zerocopy_threshold` bytes are sent with MSG_ZEROCOPY where the socket supports it; 0 disables it.
+    explicit SocketStream(int fd, size_t zerocopy_threshold = 0)
+        : fd(fd)
+    {
+        #if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+        int const one = 1;
+        if (zerocopy_threshold != 0 && ::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0)
+            this->zerocopy_threshold = zerocopy_threshold;
+        #else
+        (void)zerocopy_threshold;
+        #endif
+    }
+    ~SocketStream() { ::close(this->fd); }
+    SocketStream(SocketStream const&) = delete;
+    SocketStream& operator=(SocketStream const&) = delete;
+
+    [[nodiscard]] int getFd() const { return this->fd; }
+    [[nodiscard]] bool usesZeroCopy() const { return this->zerocopy_threshold != 0; }
+
+    // Sends `header` followed by the concatenation of `payload_parts` as one frame.
+    void sendFrame(std::span<std::byte const> header, std::span<std::span<std::byte const> const> payload_parts)
+    {
+        FrameHeader frame{ header.size(), 0 };
+        for (auto const part : payload_parts) {
+            frame.payload_size += part.size();
+        }
+        this->iov.clear();
+        this->iov.push_back(iovec{ &frame, sizeof(frame) });
+        this->iov.push_back(iovec{ const_cast<std::byte*>(header.data()), header.size() });
+        for (auto const part : payload_parts) {
+            this->iov.push_back(iovec{ const_cast<std::byte*>(part.data()), part.size() });
+        }
+        int flags = MSG_NOSIGNAL;
+        #if defined(MSG_ZEROCOPY)
+        bool const zerocopy = this->usesZeroCopy() && frame.payload_size >= this->zerocopy_threshold;
+        if (zerocopy)
+            flags |= MSG_ZEROCOPY;
+        #endif
+        std::span<iovec> remaining{ this->iov };
+        while (!remaining.empty()) {
+            msghdr msg{};
+            msg.msg_iov = remaining.data();
+            msg.msg_iovlen = std::min<size_t>(remaining.size(), IOV_MAX);
+            ssize_t const sent = ::sendmsg(this->fd, &msg, flags);
+            if (sent < 0) {
+                if (errno == EINTR)
+                    continue;
+                throwError("sendmsg");
+            }
+            #if defined(MSG_ZEROCOPY)
+            if (zerocopy)
+                this->zerocopy_sends++;
+            #endif
+            remaining = advance(remaining, static_cast<size_t>(sent));
+        }
+        #if defined(MSG_ZEROCOPY)
+        // The kernel reads the caller's buffers after sendmsg() returns, so they must not be given back until it is done with them.
+        if (zerocopy)
+            this->waitZeroCopy();
+        #endif
+    }
+
+    // Receives one frame.  If its payload is exactly `payload.size()` bytes, the header goes to `header` and the payload straight to `payload`,
+    // and true is returned; otherwise the whole frame goes to `header`.
+    bool receiveFrame(std::vector<std::byte>& header, std::span<std::byte> payload)
+    {
+        FrameHeader frame;
+        this->receive(std::array{ iovec{ &frame, sizeof(frame) } });
+        bool const scatter = frame.payload_size == payload.size();
+        if (frame.header_size > max_message_bytes || (!scatter && frame.payload_size > max_message_bytes - frame.header_size)) {
+            // The rest of the frame is never read, so the stream can't be used again.
+            ::shutdown(this->fd, SHUT_RDWR);
+            throw RemoteTargetException("Remote message too large!");
+        }
+        header.resize(scatter ? frame.header_size : frame.header_size + frame.payload_size);
+        this->receive(std::array{ iovec{ header.data(), header.size() }, iovec{ payload.data(), scatter ? payload.size() : 0 } });
+        return scatter;
+    }
+
+    // Waits up to `timeout` for the next frame to start arriving.
+    bool waitReadable(std::chrono::milliseconds timeout)
+    {
+        pollfd pfd{ this->fd, POLLIN, 0 };
+        int const rv = ::poll(&pfd, 1, static_cast<int>(timeout.count()));
+        if (rv < 0 && errno != EINTR)
+            throwError("poll");
+        return rv > 0;
+    }
+
+private:
+    struct FrameHeader
+    {
+        uint64_t header_size;
+        uint64_t payload_size;
+    };
+
+    template <size_t N>
+    void receive(std::array<iovec, N> vecs)
+    {
+        std::span<iovec> remaining{ vecs };
+        while (!remaining.empty() && remaining.front().iov_len == 0) {
+            remaining = remaining.subspan(1);
+        }
+        while (!remaining.empty()) {
+            msghdr msg{};
+            msg.msg_iov = remaining.data();
+            msg.msg_iovlen = remaining.size();
+            ssize_t const received = ::recvmsg(this->fd, &msg, MSG_WAITALL);
+            if (received < 0) {
+                if (errno == EINTR)
+                    continue;
+                throwError("recvmsg");
+            }
+            if (received == 0)
+                throw RemoteTargetException("Remote connection closed!");
+            remaining = advance(remaining, static_cast<size_t>(received));
+        }
+    }
+    // Drops `count` bytes from the front of `vecs`.
+    static std::span<iovec> advance(std::span<iovec> vecs, size_t count)
+    {
+        while (!vecs.empty() && count >= vecs.front().iov_len) {
+            count -= vecs.front().iov_len;
+            vecs = vecs.subspan(1);
+        }
+        if (!vecs.empty()) {
+            vecs.front().iov_base = static_cast<std::byte*>(vecs.front().iov_base) + count;
+            vecs.front().iov_len -= count;
+        }
+        return vecs;
+    }
+
+    #if defined(MSG_ZEROCOPY)
+    // Reads completion notifications from the error queue until every MSG_ZEROCOPY send so far has completed.
+    void waitZeroCopy()
+    {
+        while (this->zerocopy_done < this->zerocopy_sends) {
+            alignas(cmsghdr) char control[128];
+            msghdr msg{};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (::recvmsg(this->fd, &msg, MSG_ERRQUEUE) < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    // Completions are signalled as POLLERR, which poll() always reports.
+                    pollfd pfd{ this->fd, 0, 0 };
+                    ::poll(&pfd, 1, -1);
+                    continue;
+                }
+                if (errno == EINTR)
+                    continue;
+                throwError("recvmsg(MSG_ERRQUEUE)");
+            }
+            for (cmsghdr* cm = CMSG_FIRSTHDR(&msg) ; cm != nullptr ; cm = CMSG_NXTHDR(&msg, cm)) {
+                sock_extended_err const* const err = reinterpret_cast<sock_extended_err const*>(CMSG_DATA(cm));
+                if (err->ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+                    this->zerocopy_done = std::max<uint64_t>(this->zerocopy_done, uint64_t{ err->ee_data } + 1);
+            }
+        }
+    }
+    #endif
+
+    [[noreturn]] static void throwError(char const* what)
+    {
+        throw RemoteTargetException(std::format("{} failed: {}", what, std::strerror(errno)));
+    }
+
+    int fd;
+    size_t zerocopy_threshold = 0;
+    uint64_t zerocopy_sends = 0;
+    uint64_t zerocopy_done = 0;
+    std::vector<iovec> iov;
+};
+
+// The client end of a socket transport.  Bulk write data is sent from the caller's span, and bulk read data is received into the caller's span.
+class SocketClientTransport : public IRemoteTransport
+{
+public:
+    // Takes ownership of the connected stream socket `fd`.
+    explicit SocketClientTransport(int fd, size_t zerocopy_threshold = 0)
+        : stream(fd, zerocopy_threshold)
+    {}
+
+    virtual void transact(std::span<std::byte const> request, std::vector<std::byte>& response) override
+    {
+        this->transact(std::span{ &request, 1 }, response, {});
+    }
+    virtual bool transact(std::span<std::span<std::byte const> const> request_parts, std::vector<std::byte>& response, std::span<std::byte> response_payload) override
+    {
+        std::lock_guard lock(this->mutex);
+        assert(!request_parts.empty());
+        this->stream.sendFrame(request_parts.front(), request_parts.subspan(1));
+        return this->stream.receiveFrame(response, response_payload);
+    }
+
+private:
+    SocketStream stream;
+    std::mutex mutex;
+};
+
+// The server end of a socket transport, for one connection.  Bulk read data is sent straight from the server's buffer.
+class SocketServerTransport
+{
+public:
+    // Takes ownership of the connected stream socket `fd`.
+    explicit SocketServerTransport(int fd, size_t zerocopy_threshold = 0)
+        : stream(fd, zerocopy_threshold)
+    {}
+    ~SocketServerTransport() { this->stop(); }
+    SocketServerTransport(SocketServerTransport const&) = delete;
+    SocketServerTransport& operator=(SocketServerTransport const&) = delete;
+
+    // Waits up to `wait` for a request, then handles it.  Returns false if no request arrived.
+    template <CRegisterServer ServerType>
+    bool serveOne(ServerType& server, std::chrono::milliseconds wait)
+    {
+        if (!this->stream.waitReadable(wait))
+            return false;
+        this->stream.receiveFrame(this->request, {});
+        std::span<std::byte const> payload;
+        server.handle(this->request, this->response, payload);
+        this->stream.sendFrame(this->response, std::span{ &payload, 1 });
+        return true;
+    }
+
+    // Serves requests on a background thread until stop(), or until the connection fails.
+    template <CRegisterServer ServerType>
+    void start(ServerType& server)
+    {
+        this->stop();
+        this->running = true;
+        this->thread = std::thread([this, &server] {
+            try {
+                while (this->running.load(std::memory_order_relaxed)) {
+                    this->serveOne(server, std::chrono::milliseconds(100));
+                }
+            }
+            catch (RemoteTargetException const&) {
+                this->running = false;
+            }
+        });
+    }
+    void stop()
+    {
+        this->running = false;
+        if (this->thread.joinable())
+            this->thread.join();
+    }
+    [[nodiscard]] bool isRunning() const { return this->running; }
+
+private:
+    SocketStream stream;
+    std::vector<std::byte> request;
+    std::vector<std::byte> response;
+    std::atomic<bool> running = false;
+    std::thread thread;
+};
+
+}
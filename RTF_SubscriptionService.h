@@ -0,0 +1,261 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+
+namespace RTF {
+
+using SubscriptionId = uint32_t;
+
+template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+class RegisterSubscriptionService
+{
+public:
+    using TargetType = IRegisterTarget<AddressType, DataType>;
+    // Receives the masked value before and after the change.
+    using CallbackType = std::function<void(TargetType& target, AddressType addr, DataType old_value, DataType new_value)>;
+    using ErrorHandlerType = std::function<void(TargetType& target, std::exception const& ex)>;
+
+    RegisterSubscriptionService() = default;
+    ~RegisterSubscriptionService() { this->stop(); }
+    RegisterSubscriptionService(RegisterSubscriptionService const&) = delete;
+    RegisterSubscriptionService& operator=(RegisterSubscriptionService const&) = delete;
+
+    // Subscriptions with the same (target, addr, mask) share one watch, and every watch on a target is sampled with one compRead() per addr.
+    SubscriptionId subscribe(TargetType& target, AddressType addr, DataType mask, CallbackType callback)
+    {
+        std::lock_guard lock(this->mutex);
+        SubscriptionId const id = this->next_id++;
+        Watch& watch = this->watches[WatchKey{ &target, addr, mask }];
+        watch.subscribers.emplace_back(id, std::make_shared<CallbackType>(std::move(callback)));
+        this->subscription_keys.emplace(id, WatchKey{ &target, addr, mask });
+        this->plans_dirty = true;
+        return id;
+    }
+    void unsubscribe(SubscriptionId id)
+    {
+        std::lock_guard lock(this->mutex);
+        auto const key_it = this->subscription_keys.find(id);
+        if (key_it == this->subscription_keys.end())
+            return;
+        auto const watch_it = this->watches.find(key_it->second);
+        std::erase_if(watch_it->second.subscribers, [id](auto const& sub) { return sub.first == id; });
+        if (watch_it->second.subscribers.empty())
+            this->watches.erase(watch_it);
+        this->subscription_keys.erase(key_it);
+        this->plans_dirty = true;
+    }
+
+    void setErrorHandler(ErrorHandlerType handler)
+    {
+        std::lock_guard lock(this->mutex);
+        this->error_handler = std::move(handler);
+    }
+
+    // Samples every subscribed register once and dispatches callbacks for changed values, in the calling thread.
+    // The first sample of a watch only establishes its baseline.
+    void poll()
+    {
+        std::lock_guard poll_lock(this->poll_mutex);
+        std::unique_lock lock(this->mutex);
+        if (this->plans_dirty)
+            this->rebuildPlans();
+        std::vector<TargetType*> targets;
+        targets.reserve(this->plans.size());
+        for (auto const& [target, plan] : this->plans) {
+            targets.push_back(target);
+        }
+        Events events;
+        std::vector<std::pair<TargetType*, std::exception_ptr>> errors;
+        for (TargetType* const target : targets) {
+            auto plan_it = this->plans.find(target);
+            if (plan_it == this->plans.end())
+                continue;
+            Plan& plan = plan_it->second;
+            // Sampling doesn't touch the subscription tables, so don't block subscribe()/unsubscribe() during bus access.
+            // Only poll() changes the plans, so the plan is safe to use meanwhile.
+            lock.unlock();
+            std::exception_ptr error;
+            try {
+                target->compRead(plan.addresses, plan.data);
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+            lock.lock();
+            if (this->plans_dirty) {
+                // Subscriptions changed underneath us, so the plan's watches may be gone.  Rebuild the plans, then apply the sample
+                // to the watches that remain, and carry on with the other targets.
+                Plan const sampled = std::move(plan);
+                this->rebuildPlans();
+                if (!this->plans.contains(target))
+                    continue;
+                if (error) {
+                    errors.emplace_back(target, error);
+                    continue;
+                }
+                for (size_t i = 0 ; i < sampled.addresses.size() ; i++) {
+                    AddressType const addr = sampled.addresses[i];
+                    // A watch added during the read takes this sample as its baseline, or it might never get one under constant churn.
+                    for (auto it = this->watches.lower_bound(WatchKey{ target, addr, DataType{} }) ; it != this->watches.end() && std::get<0>(it->first) == target && std::get<1>(it->first) == addr ; ++it) {
+                        update(it->second, target, addr, sampled.data[i], events);
+                    }
+                }
+                continue;
+            }
+            if (error) {
+                errors.emplace_back(target, error);
+                continue;
+            }
+            for (size_t i = 0 ; i < plan.addresses.size() ; i++) {
+                for (Watch* const watch : plan.watches[i]) {
+                    update(*watch, target, plan.addresses[i], plan.data[i], events);
+                }
+            }
+        }
+        ErrorHandlerType const error_handler = this->error_handler;
+        lock.unlock();
+
+        for (auto const& [callback, target, addr, old_value, new_value] : events) {
+            try {
+                (*callback)(*target, addr, old_value, new_value);
+            }
+            catch (...) {
+                report(error_handler, *target, std::current_exception());
+            }
+        }
+        for (auto const& [target, error] : errors) {
+            report(error_handler, *target, error);
+        }
+    }
+
+    // Starts a background thread which calls poll() every `interval`, or immediately after trigger().
+    void start(std::chrono::microseconds interval)
+    {
+        this->stop();
+        this->running = true;
+        this->sampler = std::thread([this, interval] {
+            std::unique_lock lock(this->sampler_mutex);
+            while (this->running) {
+                lock.unlock();
+                try {
+                    this->poll();
+                }
+                catch (...) {
+                    // Only a throwing error handler gets here, and it has nowhere else to go; keep sampling.
+                }
+                lock.lock();
+                this->sampler_cv.wait_for(lock, interval, [this] { return !this->running || this->triggered; });
+                this->triggered = false;
+            }
+        });
+    }
+    void stop()
+    {
+        {
+            std::lock_guard lock(this->sampler_mutex);
+            this->running = false;
+        }
+        this->sampler_cv.notify_one();
+        if (this->sampler.joinable())
+            this->sampler.join();
+    }
+    // Wakes the background sampler early, e.g. from an interrupt or eventfd handler.
+    void trigger()
+    {
+        {
+            std::lock_guard lock(this->sampler_mutex);
+            this->triggered = true;
+        }
+        this->sampler_cv.notify_one();
+    }
+
+private:
+    static void report(ErrorHandlerType const& error_handler, TargetType& target, std::exception_ptr error)
+    {
+        if (!error_handler)
+            return;
+        try {
+            std::rethrow_exception(error);
+        }
+        catch (std::exception const& ex) {
+            error_handler(target, ex);
+        }
+        catch (...) {
+            error_handler(target, std::runtime_error("Unknown exception!"));
+        }
+    }
+
+    using WatchKey = std::tuple<TargetType*, AddressType, DataType>;
+    struct Watch
+    {
+        DataType key_mask = {};
+        DataType last = {};
+        bool valid = false;
+        std::vector<std::pair<SubscriptionId, std::shared_ptr<CallbackType>>> subscribers;
+    };
+    using Events = std::vector<std::tuple<std::shared_ptr<CallbackType>, TargetType*, AddressType, DataType, DataType>>;
+
+    static void update(Watch& watch, TargetType* target, AddressType addr, DataType value, Events& events)
+    {
+        DataType const new_value = value & watch.key_mask;
+        if (watch.valid && watch.last == new_value)
+            return;
+        if (watch.valid) {
+            for (auto const& sub : watch.subscribers) {
+                events.emplace_back(sub.second, target, addr, watch.last, new_value);
+            }
+        }
+        watch.last = new_value;
+        watch.valid = true;
+    }
+    struct Plan
+    {
+        std::vector<AddressType> addresses;
+        std::vector<DataType> data;
+        std::vector<std::vector<Watch*>> watches;
+    };
+
+    void rebuildPlans()
+    {
+        this->plans.clear();
+        for (auto& [key, watch] : this->watches) {
+            auto const [target, addr, mask] = key;
+            watch.key_mask = mask;
+            Plan& plan = this->plans[target];
+            // Watches are ordered by (target, addr, mask), so each address's watches are adjacent.
+            if (plan.addresses.empty() || plan.addresses.back() != addr) {
+                plan.addresses.push_back(addr);
+                plan.watches.emplace_back();
+            }
+            plan.watches.back().push_back(&watch);
+        }
+        for (auto& [target, plan] : this->plans) {
+            plan.data.resize(plan.addresses.size());
+        }
+        this->plans_dirty = false;
+    }
+
+    std::mutex mutex;
+    std::mutex poll_mutex;
+    std::map<WatchKey, Watch> watches;
+    std::unordered_map<SubscriptionId, WatchKey> subscription_keys;
+    std::unordered_map<TargetType*, Plan> plans;
+    bool plans_dirty = false;
+    SubscriptionId next_id = 1;
+    ErrorHandlerType error_handler;
+
+    std::mutex sampler_mutex;
+    std::condition_variable sampler_cv;
+    std::thread sampler;
+    bool running = false;
+    bool triggered = false;
+};
+
+}
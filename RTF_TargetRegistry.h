@@ -0,0 +1,328 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+namespace RTF {
+
+using TargetId = uint32_t;
+inline constexpr TargetId invalid_target_id = ~TargetId{0};
+
+struct TargetCapabilities
+{
+    size_t max_seq_burst = 0;   // 0 means unknown / unlimited
+    size_t max_fifo_burst = 0;
+    size_t max_comp_burst = 0;
+    bool native_seq = false;    // seqWrite/seqRead are implemented with a single lower-level access
+    bool native_fifo = false;
+    bool native_comp = false;
+    bool thread_safe = false;   // target may be accessed concurrently from multiple threads
+};
+
+// Updated by StatisticsRegisterTarget, or directly by the application.
+struct TargetStatistics
+{
+    std::atomic<uint64_t> operations = 0;
+    std::atomic<uint64_t> reads = 0;
+    std::atomic<uint64_t> writes = 0;
+    std::atomic<uint64_t> errors = 0;
+};
+
+class DuplicateTargetNameException : public std::runtime_error
+{
+public:
+    DuplicateTargetNameException(std::string_view name)
+        : std::runtime_error(std::format("Target '{}' is already registered!", name))
+    {}
+};
+
+template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+class TargetRegistry
+{
+public:
+    using TargetType = IRegisterTarget<AddressType, DataType>;
+
+    struct Entry
+    {
+        TargetId const id;
+        std::string const name;
+        std::string const domain;
+        TargetType* const target;
+        TargetCapabilities const capabilities;
+        TargetStatistics statistics;
+    };
+
+    static TargetRegistry& global()
+    {
+        static TargetRegistry registry;
+        return registry;
+    }
+
+    TargetId add(TargetType& target, TargetCapabilities capabilities = {})
+    {
+        std::unique_lock lock(this->mutex);
+        std::string_view const name = target.getName();
+        if (this->by_name.contains(name))
+            throw DuplicateTargetNameException(name);
+        bool const new_slot = this->free_slots.empty();
+        if (new_slot) {
+            assert(this->slots.size() < max_slots);
+            // So that remove() can always return the slot without allocating.
+            this->free_slots.reserve(this->slots.size() + 1);
+            this->slots.emplace_back();
+        }
+        size_t const slot = new_slot ? this->slots.size() - 1 : this->free_slots.back();
+        TargetId const id = makeId(slot, this->slots[slot].generation);
+        // The entry is only published once it is in every index, and a throw part-way takes it back out of them.
+        std::shared_ptr<Entry> entry;
+        try {
+            entry = std::shared_ptr<Entry>(new Entry{ id, std::string(name), std::string(target.getDomain()), &target, capabilities, {} });
+            this->by_name.emplace(entry->name, id);
+            this->by_domain[entry->domain].push_back(id);
+        }
+        catch (...) {
+            if (entry) {
+                this->by_name.erase(entry->name);
+                auto const domain_it = this->by_domain.find(entry->domain);
+                if (domain_it != this->by_domain.end() && domain_it->second.empty())
+                    this->by_domain.erase(domain_it);
+            }
+            if (new_slot)
+                this->slots.pop_back();
+            throw;
+        }
+        this->slots[slot].entry = std::move(entry);
+        if (!new_slot)
+            this->free_slots.pop_back();
+        return id;
+    }
+    void remove(TargetId id)
+    {
+        std::unique_lock lock(this->mutex);
+        Entry* const entry = this->lookup(id);
+        if (!entry)
+            return;
+        this->by_name.erase(this->by_name.find(entry->name));
+        auto domain_it = this->by_domain.find(entry->domain);
+        std::erase(domain_it->second, id);
+        if (domain_it->second.empty())
+            this->by_domain.erase(domain_it);
+        // The entry itself lives on as long as someone still holds it; the slot is reused under the next generation.
+        Slot& slot = this->slots[id & slot_mask];
+        slot.entry.reset();
+        slot.generation++;
+        this->free_slots.push_back(id & slot_mask);
+    }
+
+    [[nodiscard]] std::shared_ptr<Entry> find(TargetId id) const
+    {
+        std::shared_lock lock(this->mutex);
+        if (!this->lookup(id))
+            return nullptr;
+        return this->slots[id & slot_mask].entry;
+    }
+    [[nodiscard]] std::shared_ptr<Entry> find(std::string_view name) const
+    {
+        std::shared_lock lock(this->mutex);
+        auto const it = this->by_name.find(name);
+        if (it == this->by_name.end())
+            return nullptr;
+        return this->slots[it->second & slot_mask].entry;
+    }
+    [[nodiscard]] TargetId idOf(std::string_view name) const
+    {
+        std::shared_lock lock(this->mutex);
+        auto const it = this->by_name.find(name);
+        return it == this->by_name.end() ? invalid_target_id : it->second;
+    }
+    [[nodiscard]] std::vector<std::shared_ptr<Entry>> findByDomain(std::string_view domain) const
+    {
+        std::shared_lock lock(this->mutex);
+        std::vector<std::shared_ptr<Entry>> rv;
+        auto const it = this->by_domain.find(domain);
+        if (it == this->by_domain.end())
+            return rv;
+        for (TargetId const id : it->second) {
+            rv.push_back(this->slots[id & slot_mask].entry);
+        }
+        return rv;
+    }
+
+    template <typename FnType>
+    void forEachInDomain(std::string_view domain, FnType fn) const
+    {
+        std::shared_lock lock(this->mutex);
+        auto const it = this->by_domain.find(domain);
+        if (it == this->by_domain.end())
+            return;
+        for (TargetId const id : it->second) {
+            fn(*this->slots[id & slot_mask].entry);
+        }
+    }
+    template <typename FnType>
+    void forEach(FnType fn) const
+    {
+        std::shared_lock lock(this->mutex);
+        for (auto const& slot : this->slots) {
+            if (slot.entry)
+                fn(*slot.entry);
+        }
+    }
+
+private:
+    // A TargetId is a slot index in its low bits and the slot's generation in its high bits, so a stale ID doesn't find the slot's next target.
+    static constexpr unsigned slot_bits = 20;
+    static constexpr TargetId slot_mask = (TargetId{1} << slot_bits) - 1;
+    // The last slot is never used, so no ID is invalid_target_id.
+    static constexpr size_t max_slots = slot_mask;
+
+    struct Slot
+    {
+        std::shared_ptr<Entry> entry;
+        uint32_t generation = 0;
+    };
+    struct StringHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view sv) const { return std::hash<std::string_view>{}(sv); }
+    };
+
+    static TargetId makeId(size_t slot, uint32_t generation)
+    {
+        return static_cast<TargetId>((generation << slot_bits) | slot);
+    }
+    // Called with the mutex held.
+    Entry* lookup(TargetId id) const
+    {
+        size_t const slot = id & slot_mask;
+        if (slot >= this->slots.size() || !this->slots[slot].entry || this->slots[slot].entry->id != id)
+            return nullptr;
+        return this->slots[slot].entry.get();
+    }
+
+    mutable std::shared_mutex mutex;
+    std::vector<Slot> slots;
+    std::vector<size_t> free_slots;
+    std::unordered_map<std::string_view, TargetId, StringHash, std::equal_to<>> by_name;
+    std::map<std::string, std::vector<TargetId>, std::less<>> by_domain;
+};
+
+// Counts every access made through it in a TargetStatistics block, typically the registry entry of the target it wraps.
+// Registers are counted when they are accessed, whether or not the operation succeeds; failed operations also count as errors.
+template <ValidAddressOrDataType AddressType_, ValidAddressOrDataType DataType_>
+class StatisticsRegisterTarget : public PassthroughRegisterTarget<AddressType_, DataType_>
+{
+public:
+    using AddressType = AddressType_;
+    using DataType = DataType_;
+    using SequenceType = RegisterSequence<AddressType, DataType>;
+
+    template <typename ParentArg>
+    StatisticsRegisterTarget(ParentArg&& parent, TargetStatistics& statistics)
+        : PassthroughRegisterTarget<AddressType, DataType>(std::forward<ParentArg>(parent))
+        , statistics(statistics)
+    {}
+
+    virtual void write(AddressType addr, DataType data) override { this->count(0, 1, [&] { this->getParent().write(addr, data); }); }
+    [[nodiscard]] virtual DataType read(AddressType addr) override { return this->count(1, 0, [&] { return this->getParent().read(addr); }); }
+    virtual void readModifyWrite(AddressType addr, DataType new_data, DataType mask) override { this->count(1, 1, [&] { this->getParent().readModifyWrite(addr, new_data, mask); }); }
+    [[nodiscard]] virtual DataType writeReadBack(AddressType addr, DataType data) override { return this->count(1, 1, [&] { return this->getParent().writeReadBack(addr, data); }); }
+    virtual bool pollRead(AddressType addr, DataType expected, DataType mask, BasicPoller const& poller, DataType& out_data) override { return this->count(1, 0, [&] { return this->getParent().pollRead(addr, expected, mask, poller, out_data); }); }
+    virtual SequenceResult<DataType> executeSequence(SequenceType const& sequence) override
+    {
+        uint64_t reads = 0;
+        uint64_t writes = 0;
+        for (auto const& op : sequence.getOps()) {
+            using OpCode = typename SequenceType::OpCode;
+            switch (op.code) {
+            case OpCode::Write:
+                writes++;
+                break;
+            case OpCode::Read:
+            case OpCode::ReadVerify:
+            case OpCode::PollRead:
+                reads++;
+                break;
+            case OpCode::ReadModifyWrite:
+            case OpCode::WriteVerify:
+                reads++;
+                writes++;
+                break;
+            default:
+                break;
+            }
+        }
+        auto result = this->count(reads, writes, [&] { return this->getParent().executeSequence(sequence); });
+        if (result.error)
+            this->statistics.errors.fetch_add(1, std::memory_order_relaxed);
+        return result;
+    }
+
+    virtual void seqWrite(AddressType start_addr, std::span<DataType const> data, size_t increment = sizeof(DataType)) override { this->count(0, data.size(), [&] { this->getParent().seqWrite(start_addr, data, increment); }); }
+    virtual void seqRead(AddressType start_addr, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override { this->count(out_data.size(), 0, [&] { this->getParent().seqRead(start_addr, out_data, increment); }); }
+    virtual void seqFill(AddressType start_addr, DataType value, size_t count, size_t increment = sizeof(DataType)) override { this->count(0, count, [&] { this->getParent().seqFill(start_addr, value, count, increment); }); }
+    virtual void seqReadModifyWrite(AddressType start_addr, DataType new_data, DataType mask, size_t count, size_t increment = sizeof(DataType)) override { this->count(count, count, [&] { this->getParent().seqReadModifyWrite(start_addr, new_data, mask, count, increment); }); }
+    virtual void blockWrite(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType const> data, size_t increment = sizeof(DataType)) override { this->count(0, data.size(), [&] { this->getParent().blockWrite(start_addr, rows, row_stride, data, increment); }); }
+    virtual void blockRead(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override { this->count(out_data.size(), 0, [&] { this->getParent().blockRead(start_addr, rows, row_stride, out_data, increment); }); }
+    virtual void fifoWrite(AddressType fifo_addr, std::span<DataType const> data) override { this->count(0, data.size(), [&] { this->getParent().fifoWrite(fifo_addr, data); }); }
+    virtual void fifoRead(AddressType fifo_addr, std::span<DataType> out_data) override { this->count(out_data.size(), 0, [&] { this->getParent().fifoRead(fifo_addr, out_data); }); }
+    virtual void compWrite(std::span<std::pair<AddressType, DataType> const> addr_data) override { this->count(0, addr_data.size(), [&] { this->getParent().compWrite(addr_data); }); }
+    virtual void compWrite(std::span<AddressType const> const addresses, std::span<DataType const> data) override { this->count(0, data.size(), [&] { this->getParent().compWrite(addresses, data); }); }
+    virtual void compRead(std::span<AddressType const> const addresses, std::span<DataType> out_data) override { this->count(out_data.size(), 0, [&] { this->getParent().compRead(addresses, out_data); }); }
+
+private:
+    template <typename FnType>
+    decltype(auto) count(uint64_t reads, uint64_t writes, FnType fn)
+    {
+        this->statistics.operations.fetch_add(1, std::memory_order_relaxed);
+        if (reads != 0)
+            this->statistics.reads.fetch_add(reads, std::memory_order_relaxed);
+        if (writes != 0)
+            this->statistics.writes.fetch_add(writes, std::memory_order_relaxed);
+        try {
+            return fn();
+        }
+        catch (...) {
+            this->statistics.errors.fetch_add(1, std::memory_order_relaxed);
+            throw;
+        }
+    }
+
+    TargetStatistics& statistics;
+};
+
+template <typename T>
+StatisticsRegisterTarget(std::shared_ptr<T>, TargetStatistics&) -> StatisticsRegisterTarget<typename T::AddressType, typename T::DataType>;
+template <typename T>
+StatisticsRegisterTarget(std::unique_ptr<T>, TargetStatistics&) -> StatisticsRegisterTarget<typename T::AddressType, typename T::DataType>;
+template <typename T>
+StatisticsRegisterTarget(T&, TargetStatistics&) -> StatisticsRegisterTarget<typename T::AddressType, typename T::DataType>;
+
+template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+class ScopedTargetRegistration final
+{
+public:
+    using RegistryType = TargetRegistry<AddressType, DataType>;
+    ScopedTargetRegistration(IRegisterTarget<AddressType, DataType>& target, TargetCapabilities capabilities = {}, RegistryType& registry = RegistryType::global())
+        : registry(registry)
+        , id(registry.add(target, capabilities))
+    {}
+    ~ScopedTargetRegistration() { this->registry.remove(this->id); }
+    ScopedTargetRegistration(ScopedTargetRegistration const&) = delete;
+    ScopedTargetRegistration& operator=(ScopedTargetRegistration const&) = delete;
+
+    TargetId getId() const { return this->id; }
+private:
+    RegistryType& registry;
+    TargetId const id;
+};
+
+}
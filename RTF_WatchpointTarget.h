@@ -0,0 +1,312 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <optional>
+
+namespace RTF {
+
+enum class WatchAccess : uint8_t
+{
+    Read = 1,
+    Write = 2,
+    ReadWrite = 3,
+};
+
+using WatchpointId = uint32_t;
+
+class WatchpointBreakException : public std::runtime_error
+{
+public:
+    template <ValidAddressOrDataType AddressType, ValidAddressOrDataType DataType>
+    WatchpointBreakException(WatchpointId id, WatchAccess access, AddressType addr, DataType data)
+        : std::runtime_error(std::format("Watchpoint {} hit! {}(0x{:0{}x}) = 0x{:0{}x}", id, access == WatchAccess::Write ? "Write" : "Read", addr, sizeof(AddressType) * 2, data, sizeof(DataType) * 2))
+    {}
+};
+
+template <ValidAddressOrDataType AddressType_, ValidAddressOrDataType DataType_>
+class WatchpointRegisterTarget : public PassthroughRegisterTarget<AddressType_, DataType_>
+{
+public:
+    using AddressType = AddressType_;
+    using DataType = DataType_;
+    using PassthroughRegisterTarget<AddressType, DataType>::PassthroughRegisterTarget;
+
+    struct WatchEvent
+    {
+        WatchpointId id;
+        WatchAccess access;
+        AddressType addr;
+        DataType data;
+    };
+    using CallbackType = std::function<void(WatchEvent const&)>;
+
+    // Calls `callback` after every matching access to a register in [first_addr, last_addr].
+    WatchpointId addWatchpoint(AddressType first_addr, AddressType last_addr, WatchAccess access, CallbackType callback)
+    {
+        return this->add({ 0, first_addr, last_addr, access, 0, 0, std::make_shared<CallbackType>(std::move(callback)) });
+    }
+    // Same, but only when `(data & mask) == (value & mask)`.
+    WatchpointId addWatchpoint(AddressType first_addr, AddressType last_addr, WatchAccess access, DataType value, DataType mask, CallbackType callback)
+    {
+        return this->add({ 0, first_addr, last_addr, access, value & mask, mask, std::make_shared<CallbackType>(std::move(callback)) });
+    }
+    // Throws WatchpointBreakException out of the operation that accessed `value`.
+    WatchpointId addBreakOnValue(AddressType first_addr, AddressType last_addr, WatchAccess access, DataType value, DataType mask)
+    {
+        return this->addWatchpoint(first_addr, last_addr, access, value, mask, [](WatchEvent const& ev) {
+            throw WatchpointBreakException(ev.id, ev.access, ev.addr, ev.data);
+        });
+    }
+    void removeWatchpoint(WatchpointId id)
+    {
+        std::erase_if(this->watchpoints, [id](Watchpoint const& wp) { return wp.id == id; });
+        this->rebuildIndex();
+    }
+    void clearWatchpoints()
+    {
+        this->watchpoints.clear();
+        this->rebuildIndex();
+    }
+
+    virtual void write(AddressType addr, DataType data) override
+    {
+        this->getParent().write(addr, data);
+        if (this->mayMatch(addr, addr))
+            this->notify(WatchAccess::Write, addr, data);
+    }
+    [[nodiscard]] virtual DataType read(AddressType addr) override
+    {
+        DataType const rv = this->getParent().read(addr);
+        if (this->mayMatch(addr, addr))
+            this->notify(WatchAccess::Read, addr, rv);
+        return rv;
+    }
+    virtual void readModifyWrite(AddressType addr, DataType new_data, DataType mask) override
+    {
+        if (!this->mayMatch(addr, addr))
+            return this->getParent().readModifyWrite(addr, new_data, mask);
+        // Split into a read and a write so both values are observable
+        this->IRegisterTarget<AddressType, DataType>::readModifyWrite(addr, new_data, mask);
+    }
+    [[nodiscard]] virtual DataType writeReadBack(AddressType addr, DataType data) override
+    {
+        if (!this->mayMatch(addr, addr))
+            return this->getParent().writeReadBack(addr, data);
+        return this->IRegisterTarget<AddressType, DataType>::writeReadBack(addr, data);
+    }
+    // Watched polls run locally so every read is observable
+    virtual bool pollRead(AddressType addr, DataType expected, DataType mask, BasicPoller const& poller, DataType& out_data) override
+    {
+        if (!this->mayMatch(addr, addr))
+            return this->getParent().pollRead(addr, expected, mask, poller, out_data);
+        return this->IRegisterTarget<AddressType, DataType>::pollRead(addr, expected, mask, poller, out_data);
+    }
+    virtual SequenceResult<DataType> executeSequence(RegisterSequence<AddressType, DataType> const& sequence) override
+    {
+        if (this->watchpoints.empty())
+            return this->getParent().executeSequence(sequence);
+        return this->IRegisterTarget<AddressType, DataType>::executeSequence(sequence);
+    }
+
+    virtual void seqWrite(AddressType start_addr, std::span<DataType const> data, size_t increment = sizeof(DataType)) override
+    {
+        this->getParent().seqWrite(start_addr, data, increment);
+        if (!data.empty() && this->mayMatch(start_addr, seqLast(start_addr, data.size(), increment))) {
+            for (size_t i = 0 ; i < data.size() ; i++) {
+                this->notify(WatchAccess::Write, start_addr + (increment * i), data[i]);
+            }
+        }
+    }
+    virtual void seqRead(AddressType start_addr, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override
+    {
+        this->getParent().seqRead(start_addr, out_data, increment);
+        if (!out_data.empty() && this->mayMatch(start_addr, seqLast(start_addr, out_data.size(), increment))) {
+            for (size_t i = 0 ; i < out_data.size() ; i++) {
+                this->notify(WatchAccess::Read, start_addr + (increment * i), out_data[i]);
+            }
+        }
+    }
+    virtual void seqFill(AddressType start_addr, DataType value, size_t count, size_t increment = sizeof(DataType)) override
+    {
+        this->getParent().seqFill(start_addr, value, count, increment);
+        if (count != 0 && this->mayMatch(start_addr, seqLast(start_addr, count, increment))) {
+            for (size_t i = 0 ; i < count ; i++) {
+                this->notify(WatchAccess::Write, start_addr + (increment * i), value);
+            }
+        }
+    }
+    virtual void seqReadModifyWrite(AddressType start_addr, DataType new_data, DataType mask, size_t count, size_t increment = sizeof(DataType)) override
+    {
+        if (count == 0 || !this->mayMatch(start_addr, seqLast(start_addr, count, increment)))
+            return this->getParent().seqReadModifyWrite(start_addr, new_data, mask, count, increment);
+        // Split into a seqRead and a seqWrite so both values are observable
+        this->IRegisterTarget<AddressType, DataType>::seqReadModifyWrite(start_addr, new_data, mask, count, increment);
+    }
+    // Rectangles that may touch a watchpoint are split into rows, which are checked by seqWrite()/seqRead()
+    virtual void blockWrite(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType const> data, size_t increment = sizeof(DataType)) override
+    {
+        assert(rows != 0 && data.size() % rows == 0);
+        if (data.empty() || !this->mayMatch(start_addr, blockLast(start_addr, rows, row_stride, data.size(), increment)))
+            return this->getParent().blockWrite(start_addr, rows, row_stride, data, increment);
+        this->IRegisterTarget<AddressType, DataType>::blockWrite(start_addr, rows, row_stride, data, increment);
+    }
+    virtual void blockRead(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override
+    {
+        assert(rows != 0 && out_data.size() % rows == 0);
+        if (out_data.empty() || !this->mayMatch(start_addr, blockLast(start_addr, rows, row_stride, out_data.size(), increment)))
+            return this->getParent().blockRead(start_addr, rows, row_stride, out_data, increment);
+        this->IRegisterTarget<AddressType, DataType>::blockRead(start_addr, rows, row_stride, out_data, increment);
+    }
+
+    virtual void fifoWrite(AddressType fifo_addr, std::span<DataType const> data) override
+    {
+        this->getParent().fifoWrite(fifo_addr, data);
+        if (this->mayMatch(fifo_addr, fifo_addr)) {
+            for (auto const d : data) {
+                this->notify(WatchAccess::Write, fifo_addr, d);
+            }
+        }
+    }
+    virtual void fifoRead(AddressType fifo_addr, std::span<DataType> out_data) override
+    {
+        this->getParent().fifoRead(fifo_addr, out_data);
+        if (this->mayMatch(fifo_addr, fifo_addr)) {
+            for (auto const d : out_data) {
+                this->notify(WatchAccess::Read, fifo_addr, d);
+            }
+        }
+    }
+
+    virtual void compWrite(std::span<std::pair<AddressType, DataType> const> addr_data) override
+    {
+        this->getParent().compWrite(addr_data);
+        if (this->watchpoints.empty())
+            return;
+        for (auto const& ad : addr_data) {
+            if (this->mayMatch(ad.first, ad.first))
+                this->notify(WatchAccess::Write, ad.first, ad.second);
+        }
+    }
+    virtual void compWrite(std::span<AddressType const> const addresses, std::span<DataType const> data) override
+    {
+        this->getParent().compWrite(addresses, data);
+        if (this->watchpoints.empty())
+            return;
+        for (size_t i = 0 ; i < addresses.size() ; i++) {
+            if (this->mayMatch(addresses[i], addresses[i]))
+                this->notify(WatchAccess::Write, addresses[i], data[i]);
+        }
+    }
+    virtual void compRead(std::span<AddressType const> const addresses, std::span<DataType> out_data) override
+    {
+        this->getParent().compRead(addresses, out_data);
+        if (this->watchpoints.empty())
+            return;
+        for (size_t i = 0 ; i < addresses.size() ; i++) {
+            if (this->mayMatch(addresses[i], addresses[i]))
+                this->notify(WatchAccess::Read, addresses[i], out_data[i]);
+        }
+    }
+
+private:
+    struct Watchpoint
+    {
+        WatchpointId id;
+        AddressType first_addr;
+        AddressType last_addr;
+        WatchAccess access;
+        DataType value;
+        DataType mask;
+        std::shared_ptr<CallbackType> callback;   // shared so a callback can run while it is being removed
+    };
+    // The watched address space is split into disjoint segments, each listing every watchpoint that covers it.
+    struct Segment
+    {
+        AddressType first_addr;
+        AddressType last_addr;
+        std::vector<size_t> watchpoints;
+    };
+
+    WatchpointId add(Watchpoint wp)
+    {
+        assert(wp.first_addr <= wp.last_addr);
+        wp.id = this->next_id++;
+        this->watchpoints.push_back(std::move(wp));
+        this->rebuildIndex();
+        return this->watchpoints.back().id;
+    }
+
+    void rebuildIndex()
+    {
+        this->segments.clear();
+        if (this->watchpoints.empty())
+            return;
+        std::vector<AddressType> starts;
+        for (auto const& wp : this->watchpoints) {
+            starts.push_back(wp.first_addr);
+            if (wp.last_addr != std::numeric_limits<AddressType>::max())
+                starts.push_back(wp.last_addr + 1);
+        }
+        std::sort(starts.begin(), starts.end());
+        starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+        for (size_t s = 0 ; s < starts.size() ; s++) {
+            AddressType const first = starts[s];
+            AddressType const last = (s + 1 < starts.size()) ? starts[s + 1] - 1 : std::numeric_limits<AddressType>::max();
+            Segment seg{ first, last, {} };
+            for (size_t w = 0 ; w < this->watchpoints.size() ; w++) {
+                if (this->watchpoints[w].first_addr <= first && last <= this->watchpoints[w].last_addr)
+                    seg.watchpoints.push_back(w);
+            }
+            if (!seg.watchpoints.empty())
+                this->segments.push_back(std::move(seg));
+        }
+        this->lowest = this->segments.front().first_addr;
+        this->highest = this->segments.back().last_addr;
+    }
+
+    // Cheap rejection for the common case where nothing is watched anywhere near [first, last].
+    // An access that wraps around the address space (no `last`) may touch anything.
+    [[nodiscard]] bool mayMatch(AddressType first, std::optional<AddressType> last) const
+    {
+        return !this->segments.empty() && (!last || (first <= this->highest && this->lowest <= *last));
+    }
+
+    void notify(WatchAccess access, AddressType addr, DataType data)
+    {
+        auto it = std::upper_bound(this->segments.begin(), this->segments.end(), addr, [](AddressType a, Segment const& seg) { return a < seg.first_addr; });
+        if (it == this->segments.begin() || addr > (--it)->last_addr)
+            return;
+        // Callbacks may add or remove watchpoints, which rebuilds the index, so find every match before calling any of them.
+        std::vector<std::pair<WatchpointId, std::shared_ptr<CallbackType>>> hits;
+        for (size_t const w : it->watchpoints) {
+            Watchpoint const& wp = this->watchpoints[w];
+            if ((static_cast<uint8_t>(wp.access) & static_cast<uint8_t>(access)) == 0)
+                continue;
+            if ((data & wp.mask) != wp.value)
+                continue;
+            hits.emplace_back(wp.id, wp.callback);
+        }
+        for (auto const& [id, callback] : hits) {
+            (*callback)(WatchEvent{ id, access, addr, data });
+        }
+    }
+
+    std::vector<Watchpoint> watchpoints;
+    std::vector<Segment> segments;
+    AddressType lowest = {};
+    AddressType highest = {};
+    WatchpointId next_id = 1;
+};
+
+template <typename T>
+WatchpointRegisterTarget(std::shared_ptr<T>) -> WatchpointRegisterTarget<typename T::AddressType, typename T::DataType>;
+template <typename T>
+WatchpointRegisterTarget(std::unique_ptr<T>) -> WatchpointRegisterTarget<typename T::AddressType, typename T::DataType>;
+template <typename T>
+WatchpointRegisterTarget(T&) -> WatchpointRegisterTarget<typename T::AddressType, typename T::DataType>;
+
+}
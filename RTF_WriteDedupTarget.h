@@ -0,0 +1,269 @@
+// Copyright (c) 2024 Matt M Halenza
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "RTF.h"
+#include <algorithm>
+#include <optional>
+
+namespace RTF {
+
+template <ValidAddressOrDataType AddressType_, ValidAddressOrDataType DataType_>
+class WriteDedupRegisterTarget : public PassthroughRegisterTarget<AddressType_, DataType_>
+{
+public:
+    using AddressType = AddressType_;
+    using DataType = DataType_;
+    using PassthroughRegisterTarget<AddressType, DataType>::PassthroughRegisterTarget;
+
+    // Registers `count` non-volatile registers starting at `start_addr`, spaced `increment` apart, as candidates for deduplication.
+    // Ranges must not overlap.
+    void addShadowRange(AddressType start_addr, size_t count, size_t increment = sizeof(DataType))
+    {
+        assert(increment != 0);
+        Range const range{ start_addr, increment, count, this->values.size() };
+        this->ranges.insert(std::upper_bound(this->ranges.begin(), this->ranges.end(), range, [](Range const& a, Range const& b) { return a.start_addr < b.start_addr; }), range);
+        this->values.resize(this->values.size() + count);
+        this->states.resize(this->states.size() + count, State::Unknown);
+    }
+    // Opts a register inside a shadow range out of deduplication because the write itself has side effects.
+    void addStrobe(AddressType addr)
+    {
+        if (auto const slot = this->findSlot(addr))
+            this->states[*slot] = State::Strobe;
+    }
+    void invalidate(AddressType addr)
+    {
+        if (auto const slot = this->findSlot(addr); slot && this->states[*slot] == State::Known)
+            this->states[*slot] = State::Unknown;
+    }
+    void invalidateAll()
+    {
+        std::replace(this->states.begin(), this->states.end(), State::Known, State::Unknown);
+    }
+
+    [[nodiscard]] uint64_t getSkippedWrites() const { return this->skipped_writes; }
+
+    virtual void write(AddressType addr, DataType data) override
+    {
+        auto const slot = this->findSlot(addr);
+        if (slot && this->isKnown(*slot, data)) {
+            this->skipped_writes++;
+            return;
+        }
+        this->getParent().write(addr, data);
+        if (slot)
+            this->remember(*slot, data);
+    }
+    [[nodiscard]] virtual DataType read(AddressType addr) override
+    {
+        DataType const rv = this->getParent().read(addr);
+        if (auto const slot = this->findSlot(addr))
+            this->remember(*slot, rv);
+        return rv;
+    }
+    virtual void readModifyWrite(AddressType addr, DataType new_data, DataType mask) override
+    {
+        auto const slot = this->findSlot(addr);
+        if (!slot || this->states[*slot] != State::Known)
+            return this->getParent().readModifyWrite(addr, new_data, mask);
+        DataType const v = (this->values[*slot] & ~mask) | (new_data & mask);
+        this->write(addr, v);
+    }
+    [[nodiscard]] virtual DataType writeReadBack(AddressType addr, DataType data) override
+    {
+        auto const slot = this->findSlot(addr);
+        if (!slot)
+            return this->getParent().writeReadBack(addr, data);
+        // Written unconditionally: the caller wants to know what the device holds, not what we think it holds
+        this->invalidate(addr);
+        DataType const rv = this->getParent().writeReadBack(addr, data);
+        this->remember(*slot, rv);
+        return rv;
+    }
+    // Runs on the parent, so whatever the sequence writes is forgotten
+    virtual SequenceResult<DataType> executeSequence(RegisterSequence<AddressType, DataType> const& sequence) override
+    {
+        using OpCode = typename RegisterSequence<AddressType, DataType>::OpCode;
+        for (auto const& op : sequence.getOps()) {
+            if (op.code == OpCode::Write || op.code == OpCode::ReadModifyWrite || op.code == OpCode::WriteVerify)
+                this->invalidate(op.addr);
+        }
+        return this->getParent().executeSequence(sequence);
+    }
+    virtual bool pollRead(AddressType addr, DataType expected, DataType mask, BasicPoller const& poller, DataType& out_data) override
+    {
+        bool const rv = this->getParent().pollRead(addr, expected, mask, poller, out_data);
+        if (auto const slot = this->findSlot(addr))
+            this->remember(*slot, out_data);
+        return rv;
+    }
+
+    virtual void seqWrite(AddressType start_addr, std::span<DataType const> data, size_t increment = sizeof(DataType)) override
+    {
+        bool all_known = true;
+        for (size_t i = 0 ; i < data.size() && all_known ; i++) {
+            auto const slot = this->findSlot(start_addr + (increment * i));
+            all_known = slot && this->isKnown(*slot, data[i]);
+        }
+        if (all_known && !data.empty()) {
+            this->skipped_writes += data.size();
+            return;
+        }
+        this->getParent().seqWrite(start_addr, data, increment);
+        for (size_t i = 0 ; i < data.size() ; i++) {
+            if (auto const slot = this->findSlot(start_addr + (increment * i)))
+                this->remember(*slot, data[i]);
+        }
+    }
+    virtual void seqRead(AddressType start_addr, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override
+    {
+        this->getParent().seqRead(start_addr, out_data, increment);
+        for (size_t i = 0 ; i < out_data.size() ; i++) {
+            if (auto const slot = this->findSlot(start_addr + (increment * i)))
+                this->remember(*slot, out_data[i]);
+        }
+    }
+    virtual void seqFill(AddressType start_addr, DataType value, size_t count, size_t increment = sizeof(DataType)) override
+    {
+        bool all_known = true;
+        for (size_t i = 0 ; i < count && all_known ; i++) {
+            auto const slot = this->findSlot(start_addr + (increment * i));
+            all_known = slot && this->isKnown(*slot, value);
+        }
+        if (all_known && count != 0) {
+            this->skipped_writes += count;
+            return;
+        }
+        this->getParent().seqFill(start_addr, value, count, increment);
+        for (size_t i = 0 ; i < count ; i++) {
+            if (auto const slot = this->findSlot(start_addr + (increment * i)))
+                this->remember(*slot, value);
+        }
+    }
+    virtual void seqReadModifyWrite(AddressType start_addr, DataType new_data, DataType mask, size_t count, size_t increment = sizeof(DataType)) override
+    {
+        bool any_shadowed = false;
+        for (size_t i = 0 ; i < count && !any_shadowed ; i++) {
+            any_shadowed = this->findSlot(start_addr + (increment * i)).has_value();
+        }
+        if (!any_shadowed)
+            return this->getParent().seqReadModifyWrite(start_addr, new_data, mask, count, increment);
+        // Split into a seqRead and a seqWrite so the shadow values stay up to date
+        this->IRegisterTarget<AddressType, DataType>::seqReadModifyWrite(start_addr, new_data, mask, count, increment);
+    }
+    // Split into rows so each one is deduplicated (and remembered) by seqWrite()/seqRead()
+    virtual void blockWrite(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType const> data, size_t increment = sizeof(DataType)) override
+    {
+        this->IRegisterTarget<AddressType, DataType>::blockWrite(start_addr, rows, row_stride, data, increment);
+    }
+    virtual void blockRead(AddressType start_addr, size_t rows, size_t row_stride, std::span<DataType> out_data, size_t increment = sizeof(DataType)) override
+    {
+        this->IRegisterTarget<AddressType, DataType>::blockRead(start_addr, rows, row_stride, out_data, increment);
+    }
+
+    virtual void fifoWrite(AddressType fifo_addr, std::span<DataType const> data) override
+    {
+        this->invalidate(fifo_addr);
+        this->getParent().fifoWrite(fifo_addr, data);
+    }
+    virtual void fifoRead(AddressType fifo_addr, std::span<DataType> out_data) override
+    {
+        this->invalidate(fifo_addr);
+        this->getParent().fifoRead(fifo_addr, out_data);
+    }
+
+    virtual void compWrite(std::span<std::pair<AddressType, DataType> const> addr_data) override
+    {
+        this->dedupCompWrite(addr_data.size(), [&](size_t i) { return addr_data[i]; });
+    }
+    // The writes that survive deduplication have to be gathered anyway, so they are forwarded in the pair form.
+    virtual void compWrite(std::span<AddressType const> const addresses, std::span<DataType const> data) override
+    {
+        assert(addresses.size() == data.size());
+        this->dedupCompWrite(addresses.size(), [&](size_t i) { return std::pair{ addresses[i], data[i] }; });
+    }
+    virtual void compRead(std::span<AddressType const> const addresses, std::span<DataType> out_data) override
+    {
+        this->getParent().compRead(addresses, out_data);
+        for (size_t i = 0 ; i < addresses.size() ; i++) {
+            if (auto const slot = this->findSlot(addresses[i]))
+                this->remember(*slot, out_data[i]);
+        }
+    }
+
+private:
+    enum class State : uint8_t { Unknown, Known, Strobe };
+    struct Range
+    {
+        AddressType start_addr;
+        size_t increment;
+        size_t count;
+        size_t base;
+    };
+
+    // Forwards the entries (address, data) = get(i), i < count, that may change a register as one compWrite().
+    template <typename GetFnType>
+    void dedupCompWrite(size_t count, GetFnType get)
+    {
+        this->pending.clear();
+        for (size_t i = 0 ; i < count ; i++) {
+            std::pair<AddressType, DataType> const ad = get(i);
+            auto const slot = this->findSlot(ad.first);
+            if (slot && this->isKnown(*slot, ad.second)) {
+                this->skipped_writes++;
+                continue;
+            }
+            this->pending.push_back(ad);
+            // A later entry for the same address must not be dropped against a value that hasn't reached the device yet
+            if (slot)
+                this->remember(*slot, ad.second);
+        }
+        if (this->pending.empty())
+            return;
+        try {
+            this->getParent().compWrite(this->pending);
+        }
+        catch (...) {
+            for (auto const& ad : this->pending)
+                this->invalidate(ad.first);
+            throw;
+        }
+    }
+    [[nodiscard]] std::optional<size_t> findSlot(AddressType addr) const
+    {
+        auto it = std::upper_bound(this->ranges.begin(), this->ranges.end(), addr, [](AddressType a, Range const& r) { return a < r.start_addr; });
+        if (it == this->ranges.begin())
+            return std::nullopt;
+        --it;
+        size_t const offset = addr - it->start_addr;
+        if (offset % it->increment != 0 || offset / it->increment >= it->count)
+            return std::nullopt;
+        return it->base + offset / it->increment;
+    }
+    [[nodiscard]] bool isKnown(size_t slot, DataType data) const
+    {
+        return this->states[slot] == State::Known && this->values[slot] == data;
+    }
+    void remember(size_t slot, DataType data)
+    {
+        if (this->states[slot] == State::Strobe)
+            return;
+        this->values[slot] = data;
+        this->states[slot] = State::Known;
+    }
+
+    std::vector<Range> ranges;
+    std::vector<DataType> values;
+    std::vector<State> states;
+    std::vector<std::pair<AddressType, DataType>> pending;
+    uint64_t skipped_writes = 0;
+};
+
+template <typename T>
+WriteDedupRegisterTarget(std::shared_ptr<T>) -> WriteDedupRegisterTarget<typename T::AddressType, typename T::DataType>;
+template <typename T>
+WriteDedupRegisterTarget(std::unique_ptr<T>) -> WriteDedupRegisterTarget<typename T::AddressType, typename T::DataType>;
+template <typename T>
+WriteDedupRegisterTarget(T&) -> WriteDedupRegisterTarget<typename T::AddressType, typename T::DataType>;
+
+}